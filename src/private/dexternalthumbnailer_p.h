@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2017 ~ 2017 Deepin Technology Co., Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DEXTERNALTHUMBNAILER_P_H
+#define DEXTERNALTHUMBNAILER_P_H
+
+#include <dtkgui_global.h>
+
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QStringList>
+#include <QWaitCondition>
+
+DGUI_BEGIN_NAMESPACE
+
+/*
+ * 通过 freedesktop 的 .thumbnailer 文件注册的外部程序生成缩略图。每个任务在独立的子进程中运行，
+ * 并限制其内存、CPU 时间和运行时长，损坏的文件不会影响当前进程；同一 MIME 类型同时运行的进程数
+ * 也有上限
+ */
+class DExternalThumbnailer
+{
+public:
+    DExternalThumbnailer();
+
+    bool isEnabled() const;
+    void setEnabled(bool enabled);
+
+    int timeout() const;
+    void setTimeout(int msec);
+
+    int concurrency(const QString &mimeType) const;
+    void setConcurrency(const QString &mimeType, int count);
+
+    bool supports(const QString &mimeType) const;
+    QImage create(const QString &fileName, const QString &mimeType, int size, QString *errorString);
+
+    static QStringList splitCommand(const QString &command);
+
+private:
+    struct Thumbnailer
+    {
+        QString fileName;
+        QString exec;
+    };
+
+    void load() const;
+
+    mutable QMutex mutex;
+    QWaitCondition slotReleased;
+    bool enabled = false;
+    int timeoutMsec;
+    mutable bool loaded = false;
+    mutable QHash<QString, Thumbnailer> thumbnailers;
+    QHash<QString, int> concurrencyLimits;
+    QHash<QString, int> runningCounts;
+};
+
+DGUI_END_NAMESPACE
+
+#endif // DEXTERNALTHUMBNAILER_P_H
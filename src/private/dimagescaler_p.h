@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2017 ~ 2017 Deepin Technology Co., Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DIMAGESCALER_P_H
+#define DIMAGESCALER_P_H
+
+#include <dtkgui_global.h>
+
+#include <QImage>
+
+DGUI_BEGIN_NAMESPACE
+
+/*
+ * 按面积平均缩小图片，每个目标像素是其覆盖的全部源像素的平均值，缩小倍数很大时也不会产生摩尔纹。
+ * 先按整数倍对源像素分块求和（SSE2/AVX2/NEON 实现），得到不足目标大小两倍的中间图片，
+ * 再按实际覆盖的面积比例计算最终结果。放大时交给 QImage::scaled 处理
+ */
+class DImageScaler
+{
+public:
+    static QImage scaled(const QImage &image, const QSize &size, Qt::AspectRatioMode mode = Qt::IgnoreAspectRatio);
+
+    // 将 src 每 kx * ky 个像素求平均写入 dst，dst 的大小为 src 的 1 / kx 与 1 / ky，多余的行列被忽略
+    static void reduce(const QImage &src, QImage *dst, int kx, int ky);
+    // 按覆盖面积比例将 src 缩小到 dst 的大小，为标量实现，只用于整数倍分块之后已经较小的图片
+    static void resample(const QImage &src, QImage *dst);
+};
+
+DGUI_END_NAMESPACE
+
+#endif // DIMAGESCALER_P_H
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2017 ~ 2017 Deepin Technology Co., Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DTHUMBNAILINDEX_P_H
+#define DTHUMBNAILINDEX_P_H
+
+#include <dtkgui_global.h>
+
+#include <QFile>
+#include <QList>
+#include <QReadWriteLock>
+
+DGUI_BEGIN_NAMESPACE
+
+/*
+ * 缩略图目录的索引文件，以 URL 的 MD5 为键记录缩略图对应源文件的修改时间、大小及状态。
+ * 索引文件通过 mmap 在多个进程间共享：读取时不加锁，依靠每个条目的序列号保证读到完整的数据；
+ * 写入时在进程内加写锁，在进程间使用 flock 互斥。索引只是缓存，找不到记录时调用者应回退到
+ * 文件系统上查找。
+ */
+class DThumbnailIndex
+{
+public:
+    enum State {
+        Unknown = 0,
+        Valid = 1,
+        Failed = 2,
+        Removed = 3
+    };
+
+    struct Entry
+    {
+        QByteArray hash;
+        State state = Unknown;
+        qint64 mtime = 0;
+        qint64 size = 0;
+    };
+
+    explicit DThumbnailIndex(const QString &directory);
+    ~DThumbnailIndex();
+
+    QString fileName() const;
+
+    Entry find(const QByteArray &hash) const;
+    bool insert(const QByteArray &hash, State state, qint64 mtime, qint64 size);
+    bool remove(const QByteArray &hash);
+    bool reset(const QList<Entry> &entries);
+
+private:
+    struct Header;
+    struct Record;
+
+    Header *header() const;
+    Record *records() const;
+
+    bool open();
+    void close();
+    bool lock();
+    void unlock();
+    bool rewrite(const QList<Entry> &entries, quint32 capacity);
+    QList<Entry> entries() const;
+
+    static Record *probe(Record *records, quint32 capacity, const QByteArray &hash, bool forInsert);
+    static void write(Record *record, const QByteArray &hash, State state, qint64 mtime, qint64 size);
+
+    QString directory;
+    QFile file;
+    uchar *data = nullptr;
+    mutable QReadWriteLock mapLock;
+};
+
+DGUI_END_NAMESPACE
+
+#endif // DTHUMBNAILINDEX_P_H
@@ -0,0 +1,308 @@
+/*
+ * Copyright (C) 2017 ~ 2017 Deepin Technology Co., Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DTHUMBNAILPROVIDER_P_H
+#define DTHUMBNAILPROVIDER_P_H
+
+#include "dthumbnailprovider.h"
+#include "dexternalthumbnailer_p.h"
+#include "dthumbnailstatistics_p.h"
+
+#include <DObjectPrivate>
+
+#include <QAtomicInteger>
+#include <QCache>
+#include <QHash>
+#include <QImage>
+#include <QMap>
+#include <QMimeDatabase>
+#include <QMutex>
+#include <QPointer>
+#include <QReadWriteLock>
+#include <QSet>
+#include <QWaitCondition>
+
+QT_BEGIN_NAMESPACE
+class QSocketNotifier;
+class QTimer;
+QT_END_NAMESPACE
+
+DGUI_BEGIN_NAMESPACE
+
+/*
+ * 解码缓冲区池，每个工作线程各有一个。按大小与格式复用解码得到的图片，连续生成大量缩略图时
+ * 不必为每个文件重新分配大块内存
+ */
+class DImageBufferPool
+{
+public:
+    QImage acquire(const QSize &size, QImage::Format format);
+    void release(QImage &&image);
+
+private:
+    QList<QImage> buffers;
+};
+
+/*
+ * 以 URL 的 MD5 为键的生成权。进程内的线程之间先通过内存中的记录互斥，之后再通过 XDG_RUNTIME_DIR
+ * 中锁文件上的 flock 与其它进程互斥。构造时获取，析构时释放；等待超过 timeout 毫秒后放弃，
+ * timeout 为0时不等待
+ */
+class DThumbnailClaim
+{
+public:
+    DThumbnailClaim(const QByteArray &key, int timeout);
+    ~DThumbnailClaim();
+
+    bool isAcquired() const;
+    // 获取时其它调用者正持有此生成权
+    bool isContended() const;
+
+private:
+    Q_DISABLE_COPY(DThumbnailClaim)
+
+    void release();
+
+    QByteArray key;
+    QByteArray fileName;
+    int fd = -1;
+    bool registered = false;
+    bool contended = false;
+};
+
+class DThumbnailIndex;
+class DThumbnailService;
+class DThumbnailProviderPrivate : public DTK_CORE_NAMESPACE::DObjectPrivate
+{
+public:
+    explicit DThumbnailProviderPrivate(DThumbnailProvider *qq);
+    ~DThumbnailProviderPrivate();
+
+    void init();
+
+    QString sizeToFilePath(DThumbnailProvider::Size size) const;
+    bool isThumbnailDirectory(const QString &path) const;
+    DThumbnailIndex *thumbnailIndex(const QString &directory) const;
+
+    // 源文件路径与缩略图路径，缩略图路径为空时表示生成失败
+    typedef QPair<QString, QString> Notification;
+
+    struct ProduceResult
+    {
+        QString thumbnail;
+        QList<Notification> notifications;
+        QList<DThumbnailProvider::CallBack> callbacks;
+    };
+
+    // 可在多个线程中同时调用，错误信息及源图片大小通过参数返回
+    QString createThumbnail(const QFileInfo &info, DThumbnailProvider::Size size, QString &errorString,
+                            QList<Notification> *notifications = nullptr, QSize *sourceSize = nullptr);
+    QStringList createThumbnails(const QFileInfo &info, const QList<DThumbnailProvider::Size> &sizes, QString &errorString,
+                                 QList<Notification> *notifications = nullptr, QSize *sourceSize = nullptr);
+    // 从设备中读取数据生成缩略图，以 url 作为缓存的键
+    QString createThumbnail(QIODevice *device, const QString &url, qint64 mtime, DThumbnailProvider::Size size, QString &errorString);
+    // 查找缩略图并校验修改时间，sourceSize 小于0表示大小未知
+    QString findThumbnail(const QString &url, const QString &sourceFilePath, qint64 mtime, qint64 sourceSize,
+                          DThumbnailProvider::Size size) const;
+    void notify(const QString &sourceFilePath, const QString &thumbnail, QList<Notification> *notifications = nullptr);
+    void setErrorString(const QString &error);
+
+    // 启动足够的工作线程以处理队列中的任务，调用时需持有 dataReadWriteLock
+    void startWorkers();
+    void processProduceQueue(int workerIndex);
+
+    // 生成耗时较长时先提供的低质量预览
+    QImage createPreview(const QFileInfo &info, DThumbnailProvider::Size size) const;
+    void deliverPreview(const QString &sourceFilePath, const QImage &preview, const QList<DThumbnailProvider::PreviewCallBack> &callbacks);
+
+    void deliverResult(const ProduceResult &result);
+    bool postResult(const ProduceResult &result);
+    void deliverPendingResults();
+
+    QMimeType mimeTypeForFile(const QFileInfo &info) const;
+    bool hasThumbnail(const QFileInfo &info, QMimeType *mimeType = nullptr) const;
+
+    QString errorString;
+    mutable QMutex errorStringMutex;
+    // MAX
+    qint64 defaultSizeLimit = INT64_MAX;
+    QHash<QMimeType, qint64> sizeLimitHash;
+    // 解码后的像素数据可使用的内存上限，0表示不限制
+    qint64 decodeMemoryLimit = 256 * 1024 * 1024;
+    mutable QReadWriteLock sizeLimitLock;
+    QMimeDatabase mimeDatabase;
+
+    struct MimeCacheKey
+    {
+        quint64 device = 0;
+        quint64 inode = 0;
+        qint64 mtime = 0;
+        qint64 size = 0;
+
+        bool operator==(const MimeCacheKey &other) const
+        {
+            return device == other.device && inode == other.inode && mtime == other.mtime && size == other.size;
+        }
+    };
+
+    mutable QMutex mimeCacheMutex;
+    mutable QCache<MimeCacheKey, QMimeType> mimeCache;
+    mutable QReadWriteLock mimeDirectoriesLock;
+    QStringList extensionOnlyMimeDirectories;
+
+    // 不支持或生成失败的源文件，以路径为键并校验修改时间与大小，命中时无需再读取失败记录
+    struct KnownFailure
+    {
+        qint64 mtime = 0;
+        qint64 size = 0;
+        qint64 expiration = 0;
+        QString errorString;
+    };
+
+    bool isKnownFailure(const QFileInfo &info, qint64 mtime, QString *errorString) const;
+    void addKnownFailure(const QFileInfo &info, qint64 mtime, const QString &errorString);
+    void clearKnownFailures();
+
+    mutable QMutex knownFailuresMutex;
+    mutable QCache<QString, KnownFailure> knownFailures;
+    // 记录的有效时间，0表示不记录
+    int knownFailureTimeout;
+
+    static QSet<QString> hasThumbnailMimeHash;
+    static QReadWriteLock hasThumbnailMimeHashLock;
+
+    // 一次 appendToProduceQueue 调用，合并后的任务为每次调用各保留一项
+    struct ProduceRequest
+    {
+        DThumbnailProvider::CallBack callback;
+        DThumbnailProvider::PreviewCallBack previewCallback;
+    };
+
+    struct ProduceInfo
+    {
+        QFileInfo fileInfo;
+        DThumbnailProvider::Size size;
+        QList<ProduceRequest> requests;
+        int priority = 0;
+        // 生成期间又收到请求而重新生成，缩略图仍有效时不必再解码
+        bool rerun = false;
+    };
+
+    // 正在生成的任务，生成期间收到的请求在结束后重新生成
+    struct InFlightTask
+    {
+        QList<ProduceRequest> requests;
+        QList<ProduceRequest> pendingRequests;
+        int priority = 0;
+    };
+
+    typedef QPair<QString, DThumbnailProvider::Size> ProduceKey;
+    // 按优先级排序，同一优先级内后加入的任务排在后面
+    typedef QPair<int, quint64> ProduceOrder;
+
+    void enqueue(ProduceInfo &&info);
+    ProduceInfo dequeue();
+    void discard(const ProduceKey &key);
+    QStringList takeReadaheadFiles();
+
+    // 总是从末尾取任务：优先级最高的先处理，同一优先级内后进先出
+    QMap<ProduceOrder, ProduceInfo> produceQueue;
+    QHash<ProduceKey, ProduceOrder> produceOrders;
+    quint64 produceSequence = 0;
+    // 已没有任何请求的任务，取出时跳过
+    QSet<ProduceKey> discardedProduceInfos;
+    QHash<ProduceKey, InFlightTask> inFlightTasks;
+    qint64 mergedProduceCount = 0;
+    // 已请求预读但尚未处理的源文件
+    int readaheadCount;
+    QSet<QString> readaheadSources;
+    // 为队列中的所有任务提供预览
+    bool progressiveEnabled = false;
+
+    bool running = true;
+    // 包含 DThumbnailProvider 自身线程在内的工作线程数量上限
+    int maxThreadCount;
+    // 除 DThumbnailProvider 自身线程外的其它工作线程
+    QList<QThread *> workers;
+    // 已决定退出但可能尚未结束的工作线程的序号，它们不会再处理队列
+    QSet<int> exitingWorkers;
+    // 正在生成缩略图的工作线程数量
+    int activeWorkers = 0;
+
+    QWaitCondition waitCondition;
+    mutable QReadWriteLock dataReadWriteLock;
+
+    // 设置后生成队列的结果在此对象所在的线程中分批处理
+    mutable QMutex deliveryMutex;
+    QPointer<QObject> deliveryTarget;
+    QList<ProduceResult> pendingResults;
+    bool deliveryScheduled = false;
+
+    // 以缩略图目录为键的索引文件
+    bool indexEnabled = false;
+    mutable QMutex indexMutex;
+    mutable QHash<QString, DThumbnailIndex *> indexes;
+
+    // 缩略图目录的容量上限，0表示不限制
+    struct CacheLimit
+    {
+        qint64 bytes = 0;
+        int entries = 0;
+    };
+
+    void collectGarbage();
+
+    mutable QMutex cacheMutex;
+    QHash<int, CacheLimit> cacheLimits;
+    QThread *garbageCollector = nullptr;
+    // 置位后正在进行的清理尽快结束，与生成队列的 running 无关
+    QAtomicInt garbageCollectionCanceled;
+
+    // 监视应用打开的目录，源文件变化时立即使其缩略图失效并重新生成
+    void readWatchEvents();
+    void invalidateThumbnails(const QString &sourceFilePath);
+
+    // watchedDirectories 同时被调用者线程与处理 inotify 事件的线程访问
+    mutable QMutex watchMutex;
+    int inotifyFd = -1;
+    QSocketNotifier *inotifyNotifier = nullptr;
+    QHash<int, QString> watchedDirectories;
+
+    // 会话内共享的缩略图服务，未启用时为空
+    QImage loadThumbnailImage(const QString &filePath, int size, QString *errorString);
+
+    mutable QMutex serviceMutex;
+    DThumbnailService *service = nullptr;
+
+    // Qt 无法读取的类型交给系统中注册的外部缩略图程序
+    DExternalThumbnailer externalThumbnailer;
+
+    // 各线程无锁记录的统计数据，定时器只在设置了发送间隔后才创建
+    mutable DThumbnailStatistics statistics;
+    QTimer *statisticsTimer = nullptr;
+
+    D_DECLARE_PUBLIC(DThumbnailProvider)
+};
+
+inline uint qHash(const DThumbnailProviderPrivate::MimeCacheKey &key, uint seed = 0)
+{
+    return qHashBits(&key, sizeof(key), seed);
+}
+
+DGUI_END_NAMESPACE
+
+#endif // DTHUMBNAILPROVIDER_P_H
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2017 ~ 2017 Deepin Technology Co., Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DTHUMBNAILSERVICE_P_H
+#define DTHUMBNAILSERVICE_P_H
+
+#include <dtkgui_global.h>
+
+#include <QCache>
+#include <QImage>
+#include <QList>
+#include <QMutex>
+#include <QQueue>
+#include <QWaitCondition>
+
+#include <functional>
+
+QT_BEGIN_NAMESPACE
+class QThread;
+QT_END_NAMESPACE
+
+DGUI_BEGIN_NAMESPACE
+
+/*
+ * 会话内共享的缩略图服务。同一用户会话中第一个启用服务的进程监听 XDG_RUNTIME_DIR 中的本地套接字，
+ * 其它进程连接到它并请求缩略图；结果以密封（sealed）的 memfd 文件描述符返回，客户端直接映射
+ * 其内存，像素数据不会被复制，各进程映射同一份物理内存。提供服务的进程退出后，下一个发出请求的
+ * 进程会接替它
+ */
+class DThumbnailService
+{
+public:
+    // 在提供服务的进程中生成缩略图图片
+    typedef std::function<QImage(const QString &filePath, int size, QString *errorString)> Loader;
+
+    explicit DThumbnailService(const Loader &loader);
+    ~DThumbnailService();
+
+    bool start();
+    void stop();
+
+    bool isRunning() const;
+    bool isServer() const;
+
+    // unavailable 为 true 表示服务未能给出结果（如超时），调用者应在当前进程中生成
+    QImage request(const QString &filePath, int size, QString *errorString, bool *unavailable = nullptr);
+
+    static QString socketPath();
+
+private:
+    struct ImageFile
+    {
+        ~ImageFile();
+
+        int fd = -1;
+        int width = 0;
+        int height = 0;
+        int bytesPerLine = 0;
+        int format = 0;
+    };
+
+    // 返回连接到服务的套接字，失败时返回 -1
+    static int connectToServer();
+    bool listen();
+    void closeConnection();
+
+    void serve();
+    void serveClients();
+    void serveClient(int fd);
+
+    // 返回缓存的或新生成的图片对应的 memfd，调用者需要关闭返回的文件描述符
+    int imageFile(const QString &filePath, int size, ImageFile *info, QString *errorString);
+    static QImage mapImage(int fd, const ImageFile &info);
+
+    Loader loader;
+
+    // 只在访问以下状态时持有，收发请求期间不持有
+    mutable QMutex mutex;
+    bool running = false;
+    bool server = false;
+    int lockFd = -1;
+    // 提供服务时监听的套接字
+    int socketFd = -1;
+    // 作为客户端时空闲的连接，每个请求独占一个连接，多个线程可同时请求
+    QList<int> idleConnections;
+    // 用于唤醒服务线程使其退出
+    int wakeFd = -1;
+    QThread *serverThread = nullptr;
+    // 固定数量的线程依次处理已接受的连接，连接数再多也不会创建更多线程
+    bool serving = false;
+    QList<QThread *> clientThreads;
+    QQueue<int> pendingClients;
+    QWaitCondition pendingChanged;
+
+    QMutex cacheMutex;
+    QCache<QString, ImageFile> imageCache;
+};
+
+DGUI_END_NAMESPACE
+
+#endif // DTHUMBNAILSERVICE_P_H
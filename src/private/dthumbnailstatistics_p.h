@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2017 ~ 2017 Deepin Technology Co., Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DTHUMBNAILSTATISTICS_P_H
+#define DTHUMBNAILSTATISTICS_P_H
+
+#include <dtkgui_global.h>
+
+#include <QAtomicInteger>
+#include <QAtomicPointer>
+#include <QVariantMap>
+
+DGUI_BEGIN_NAMESPACE
+
+/*
+ * 缩略图生成的统计数据。所有计数器都是以 relaxed 方式更新的原子变量，工作线程记录时不加锁，
+ * 也不会相互等待；只有读取时才汇总为 QVariantMap。MIME 类型的槽位通过 CAS 占用，用尽后
+ * 其余类型合并记录在 "*" 中
+ */
+class DThumbnailStatistics
+{
+public:
+    enum Counter {
+        CacheHits,
+        CacheMisses,
+        CacheStale,
+        ThumbnailsCreated,
+        ThumbnailsFailed,
+        BytesWritten,
+        CounterCount
+    };
+
+    // 第 i 个区间记录小于 2^i 微秒（且不小于 2^(i-1) 微秒）的耗时
+    enum { HistogramBuckets = 32, MimeTypeSlots = 64 };
+
+    DThumbnailStatistics();
+    ~DThumbnailStatistics();
+
+    void add(Counter counter, qint64 value = 1);
+    void recordDecode(const QString &mimeType, qint64 nsecs);
+    void recordWrite(qint64 nsecs);
+
+    QVariantMap toVariantMap() const;
+    void reset();
+
+private:
+    Q_DISABLE_COPY(DThumbnailStatistics)
+
+    struct Histogram
+    {
+        void record(qint64 nsecs);
+        QVariantMap toVariantMap() const;
+        void reset();
+
+        QAtomicInteger<quint64> count;
+        QAtomicInteger<quint64> totalNsecs;
+        QAtomicInteger<quint64> buckets[HistogramBuckets];
+    };
+
+    struct MimeTypeSlot
+    {
+        QAtomicPointer<QByteArray> name;
+        Histogram histogram;
+    };
+
+    Histogram *decodeHistogram(const QString &mimeType);
+
+    QAtomicInteger<qint64> counters[CounterCount];
+    Histogram writeHistogram;
+    Histogram otherDecodeHistogram;
+    MimeTypeSlot mimeTypeSlots[MimeTypeSlots];
+};
+
+DGUI_END_NAMESPACE
+
+#endif // DTHUMBNAILSTATISTICS_P_H
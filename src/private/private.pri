@@ -6,4 +6,10 @@ HEADERS += \
     $$PWD/dfiledragserver_p.h \
     $$PWD/dregionmonitor_p.h \
     $$PWD/dtaskbarcontrol_p.h \
-    $$PWD/dfontmanager_p.h
+    $$PWD/dfontmanager_p.h \
+    $$PWD/dexternalthumbnailer_p.h \
+    $$PWD/dimagescaler_p.h \
+    $$PWD/dthumbnailindex_p.h \
+    $$PWD/dthumbnailprovider_p.h \
+    $$PWD/dthumbnailservice_p.h \
+    $$PWD/dthumbnailstatistics_p.h
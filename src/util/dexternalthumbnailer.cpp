@@ -0,0 +1,409 @@
+/*
+ * Copyright (C) 2017 ~ 2017 Deepin Technology Co., Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "private/dexternalthumbnailer_p.h"
+
+#include <QDeadlineTimer>
+#include <QDirIterator>
+#include <QFile>
+#include <QProcess>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QUrl>
+
+DGUI_BEGIN_NAMESPACE
+
+#define THUMBNAILER_GROUP "[Thumbnailer Entry]"
+#define DEFAULT_TIMEOUT 10000
+#define DEFAULT_CONCURRENCY 2
+// 子进程的虚拟内存上限（KB）
+#define PROCESS_MEMORY_LIMIT (2 * 1024 * 1024)
+
+DExternalThumbnailer::DExternalThumbnailer()
+    : timeoutMsec(DEFAULT_TIMEOUT)
+{
+
+}
+
+bool DExternalThumbnailer::isEnabled() const
+{
+    QMutexLocker locker(&mutex);
+    Q_UNUSED(locker)
+
+    return enabled;
+}
+
+void DExternalThumbnailer::setEnabled(bool enabled)
+{
+    QMutexLocker locker(&mutex);
+    Q_UNUSED(locker)
+
+    this->enabled = enabled;
+}
+
+int DExternalThumbnailer::timeout() const
+{
+    QMutexLocker locker(&mutex);
+    Q_UNUSED(locker)
+
+    return timeoutMsec;
+}
+
+void DExternalThumbnailer::setTimeout(int msec)
+{
+    QMutexLocker locker(&mutex);
+    Q_UNUSED(locker)
+
+    timeoutMsec = qMax(1, msec);
+}
+
+int DExternalThumbnailer::concurrency(const QString &mimeType) const
+{
+    QMutexLocker locker(&mutex);
+    Q_UNUSED(locker)
+
+    return concurrencyLimits.value(mimeType, DEFAULT_CONCURRENCY);
+}
+
+void DExternalThumbnailer::setConcurrency(const QString &mimeType, int count)
+{
+    QMutexLocker locker(&mutex);
+
+    concurrencyLimits[mimeType] = qMax(1, count);
+    locker.unlock();
+    slotReleased.wakeAll();
+}
+
+bool DExternalThumbnailer::supports(const QString &mimeType) const
+{
+    QMutexLocker locker(&mutex);
+    Q_UNUSED(locker)
+
+    if (!enabled)
+    {
+        return false;
+    }
+
+    load();
+
+    return thumbnailers.contains(mimeType);
+}
+
+/*
+ * 在子进程中运行 mimeType 对应的缩略图程序，返回其生成的图片，失败时返回空图片并设置 errorString
+ */
+QImage DExternalThumbnailer::create(const QString &fileName, const QString &mimeType, int size, QString *errorString)
+{
+    QMutexLocker locker(&mutex);
+
+    load();
+
+    const Thumbnailer thumbnailer = thumbnailers.value(mimeType);
+
+    if (!enabled || thumbnailer.exec.isEmpty())
+    {
+        *errorString = QStringLiteral("No external thumbnailer for ") + mimeType;
+
+        return QImage();
+    }
+
+    const int timeout = timeoutMsec;
+    // 等待空闲名额、启动与运行共用同一个时限
+    const QDeadlineTimer deadline(timeout);
+
+    // 同一 MIME 类型同时运行的进程数达到上限时等待
+    while (runningCounts.value(mimeType) >= concurrencyLimits.value(mimeType, DEFAULT_CONCURRENCY))
+    {
+        if (deadline.hasExpired() || !slotReleased.wait(&mutex, static_cast<unsigned long>(deadline.remainingTime())))
+        {
+            *errorString = QStringLiteral("External thumbnailer timed out: ") + fileName;
+
+            return QImage();
+        }
+    }
+
+    ++runningCounts[mimeType];
+    locker.unlock();
+
+    QImage image;
+    QTemporaryDir directory;
+    const QString output = directory.filePath("thumbnail.png");
+    QStringList arguments;
+
+    for (const QString &argument : splitCommand(thumbnailer.exec))
+    {
+        QString expanded;
+
+        for (int i = 0; i < argument.size(); ++i)
+        {
+            if (argument.at(i) != '%' || i + 1 == argument.size())
+            {
+                expanded.append(argument.at(i));
+
+                continue;
+            }
+
+            switch (argument.at(++i).unicode())
+            {
+            case 'u':
+                expanded.append(QUrl::fromLocalFile(fileName).toString(QUrl::FullyEncoded));
+                break;
+            case 'i':
+                expanded.append(fileName);
+                break;
+            case 'o':
+                expanded.append(output);
+                break;
+            case 's':
+                expanded.append(QString::number(size));
+                break;
+            case '%':
+                expanded.append('%');
+                break;
+            default:
+                break;
+            }
+        }
+
+        arguments.append(expanded);
+    }
+
+    if (!directory.isValid() || arguments.isEmpty())
+    {
+        *errorString = QStringLiteral("Invalid external thumbnailer: ") + thumbnailer.fileName;
+    }
+    else
+    {
+        QProcess process;
+        QProcessEnvironment environment;
+        const QProcessEnvironment &systemEnvironment = QProcessEnvironment::systemEnvironment();
+
+        // 只传递运行程序及连接图形会话所需的环境变量，其它变量（如 LD_PRELOAD、DBUS_SESSION_BUS_ADDRESS）不传递
+        for (const QString &name : {QStringLiteral("PATH"), QStringLiteral("HOME"), QStringLiteral("LANG"), QStringLiteral("LC_ALL"),
+                                    QStringLiteral("XDG_RUNTIME_DIR"), QStringLiteral("DISPLAY"), QStringLiteral("XAUTHORITY"),
+                                    QStringLiteral("WAYLAND_DISPLAY")})
+        {
+            if (systemEnvironment.contains(name))
+            {
+                environment.insert(name, systemEnvironment.value(name));
+            }
+        }
+
+        process.setProcessEnvironment(environment);
+        process.setWorkingDirectory(directory.path());
+        process.setStandardInputFile(QProcess::nullDevice());
+        process.setStandardOutputFile(QProcess::nullDevice());
+        process.setStandardErrorFile(QProcess::nullDevice());
+
+        // 由 shell 限制虚拟内存和 CPU 时间后再执行缩略图程序
+        const QString &sandbox = QStringLiteral("ulimit -v %1 2>/dev/null; ulimit -t %2 2>/dev/null; exec \"$0\" \"$@\"")
+                .arg(PROCESS_MEMORY_LIMIT).arg(timeout / 1000 + 1);
+
+        process.start(QStringLiteral("/bin/sh"), QStringList {QStringLiteral("-c"), sandbox} + arguments);
+
+        if (!process.waitForStarted(int(deadline.remainingTime())))
+        {
+            *errorString = QStringLiteral("Can not start external thumbnailer: ") + arguments.first();
+        }
+        else if (!process.waitForFinished(int(deadline.remainingTime())))
+        {
+            process.kill();
+            process.waitForFinished(1000);
+
+            *errorString = QStringLiteral("External thumbnailer timed out: ") + fileName;
+        }
+        else if (process.exitStatus() != QProcess::NormalExit || process.exitCode() != 0)
+        {
+            *errorString = QStringLiteral("External thumbnailer failed: ") + fileName;
+        }
+        else if (!image.load(output))
+        {
+            *errorString = QStringLiteral("External thumbnailer did not produce an image: ") + fileName;
+        }
+    }
+
+    locker.relock();
+
+    if (--runningCounts[mimeType] <= 0)
+    {
+        runningCounts.remove(mimeType);
+    }
+
+    locker.unlock();
+    slotReleased.wakeAll();
+
+    return image;
+}
+
+/*
+ * 按照 desktop 文件中 Exec 字段的规则拆分命令行参数
+ */
+QStringList DExternalThumbnailer::splitCommand(const QString &command)
+{
+    QStringList arguments;
+    QString argument;
+    bool quoted = false;
+    bool hasArgument = false;
+
+    for (int i = 0; i < command.size(); ++i)
+    {
+        const QChar c = command.at(i);
+
+        if (quoted)
+        {
+            if (c == '\\' && i + 1 < command.size())
+            {
+                argument.append(command.at(++i));
+            }
+            else if (c == '"')
+            {
+                quoted = false;
+            }
+            else
+            {
+                argument.append(c);
+            }
+        }
+        else if (c == '"')
+        {
+            quoted = true;
+            hasArgument = true;
+        }
+        else if (c.isSpace())
+        {
+            if (hasArgument)
+            {
+                arguments.append(argument);
+                argument.clear();
+                hasArgument = false;
+            }
+        }
+        else
+        {
+            argument.append(c);
+            hasArgument = true;
+        }
+    }
+
+    if (hasArgument)
+    {
+        arguments.append(argument);
+    }
+
+    return arguments;
+}
+
+/*
+ * 读取各数据目录下 thumbnailers 中的 .thumbnailer 文件，优先级高的目录中的文件优先
+ */
+void DExternalThumbnailer::load() const
+{
+    if (loaded)
+    {
+        return;
+    }
+
+    loaded = true;
+
+    const QStringList &directories = QStandardPaths::locateAll(QStandardPaths::GenericDataLocation,
+                                                               QStringLiteral("thumbnailers"),
+                                                               QStandardPaths::LocateDirectory);
+
+    for (const QString &directoryPath : directories)
+    {
+        QDirIterator iterator(directoryPath, {QStringLiteral("*.thumbnailer")}, QDir::Files);
+
+        while (iterator.hasNext())
+        {
+            QFile file(iterator.next());
+
+            if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+            {
+                continue;
+            }
+
+            bool inEntry = false;
+            QString tryExec;
+            Thumbnailer thumbnailer;
+            QStringList mimeTypes;
+
+            while (!file.atEnd())
+            {
+                const QString &line = QString::fromUtf8(file.readLine()).trimmed();
+
+                if (line.isEmpty() || line.startsWith('#'))
+                {
+                    continue;
+                }
+
+                if (line.startsWith('['))
+                {
+                    inEntry = line == THUMBNAILER_GROUP;
+
+                    continue;
+                }
+
+                const int separator = line.indexOf('=');
+
+                if (!inEntry || separator <= 0)
+                {
+                    continue;
+                }
+
+                const QString &key = line.left(separator).trimmed();
+                const QString &value = line.mid(separator + 1).trimmed();
+
+                if (key == "TryExec")
+                {
+                    tryExec = value;
+                }
+                else if (key == "Exec")
+                {
+                    thumbnailer.exec = value;
+                }
+                else if (key == "MimeType")
+                {
+                    for (const QString &mimeType : value.split(';'))
+                    {
+                        if (!mimeType.isEmpty())
+                        {
+                            mimeTypes.append(mimeType);
+                        }
+                    }
+                }
+            }
+
+            if (thumbnailer.exec.isEmpty()
+                    || (!tryExec.isEmpty() && QStandardPaths::findExecutable(tryExec).isEmpty()))
+            {
+                continue;
+            }
+
+            thumbnailer.fileName = file.fileName();
+
+            for (const QString &mimeType : mimeTypes)
+            {
+                if (!thumbnailers.contains(mimeType))
+                {
+                    thumbnailers.insert(mimeType, thumbnailer);
+                }
+            }
+        }
+    }
+}
+
+DGUI_END_NAMESPACE
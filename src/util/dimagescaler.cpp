@@ -0,0 +1,374 @@
+/*
+ * Copyright (C) 2017 ~ 2017 Deepin Technology Co., Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "private/dimagescaler_p.h"
+
+#include <private/qsimd_p.h>
+
+#include <QVector>
+
+#include <cmath>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// AVX2 版本在运行时检测到 CPU 支持时才使用
+#if defined(Q_PROCESSOR_X86) && defined(QT_COMPILER_SUPPORTS_AVX2) && defined(QT_COMPILER_SUPPORTS_SIMD_ALWAYS)
+#define DIMAGESCALER_AVX2
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define DIMAGESCALER_NEON
+#include <arm_neon.h>
+#endif
+
+DGUI_BEGIN_NAMESPACE
+
+typedef void (*AccumulateRow)(quint32 *sums, const uchar *source, int count);
+
+// 将一行源像素的每个字节累加到对应的 32 位和中
+static void accumulateRowScalar(quint32 *sums, const uchar *source, int count)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        sums[i] += source[i];
+    }
+}
+
+#if defined(__SSE2__)
+static void accumulateRowSse2(quint32 *sums, const uchar *source, int count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + i));
+        const __m128i low = _mm_unpacklo_epi8(bytes, zero);
+        const __m128i high = _mm_unpackhi_epi8(bytes, zero);
+        __m128i *sum = reinterpret_cast<__m128i *>(sums + i);
+
+        _mm_storeu_si128(sum, _mm_add_epi32(_mm_loadu_si128(sum), _mm_unpacklo_epi16(low, zero)));
+        _mm_storeu_si128(sum + 1, _mm_add_epi32(_mm_loadu_si128(sum + 1), _mm_unpackhi_epi16(low, zero)));
+        _mm_storeu_si128(sum + 2, _mm_add_epi32(_mm_loadu_si128(sum + 2), _mm_unpacklo_epi16(high, zero)));
+        _mm_storeu_si128(sum + 3, _mm_add_epi32(_mm_loadu_si128(sum + 3), _mm_unpackhi_epi16(high, zero)));
+    }
+
+    accumulateRowScalar(sums + i, source + i, count - i);
+}
+#endif
+
+#ifdef DIMAGESCALER_AVX2
+QT_FUNCTION_TARGET(AVX2)
+static void accumulateRowAvx2(quint32 *sums, const uchar *source, int count)
+{
+    int i = 0;
+
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m256i low = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(source + i)));
+        const __m256i high = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(source + i + 8)));
+        __m256i *sum = reinterpret_cast<__m256i *>(sums + i);
+
+        _mm256_storeu_si256(sum, _mm256_add_epi32(_mm256_loadu_si256(sum), low));
+        _mm256_storeu_si256(sum + 1, _mm256_add_epi32(_mm256_loadu_si256(sum + 1), high));
+    }
+
+    accumulateRowScalar(sums + i, source + i, count - i);
+}
+#endif
+
+#ifdef DIMAGESCALER_NEON
+static void accumulateRowNeon(quint32 *sums, const uchar *source, int count)
+{
+    int i = 0;
+
+    for (; i + 16 <= count; i += 16)
+    {
+        const uint8x16_t bytes = vld1q_u8(source + i);
+        const uint16x8_t low = vmovl_u8(vget_low_u8(bytes));
+        const uint16x8_t high = vmovl_u8(vget_high_u8(bytes));
+
+        vst1q_u32(sums + i, vaddw_u16(vld1q_u32(sums + i), vget_low_u16(low)));
+        vst1q_u32(sums + i + 4, vaddw_u16(vld1q_u32(sums + i + 4), vget_high_u16(low)));
+        vst1q_u32(sums + i + 8, vaddw_u16(vld1q_u32(sums + i + 8), vget_low_u16(high)));
+        vst1q_u32(sums + i + 12, vaddw_u16(vld1q_u32(sums + i + 12), vget_high_u16(high)));
+    }
+
+    accumulateRowScalar(sums + i, source + i, count - i);
+}
+#endif
+
+static AccumulateRow accumulateRowFunction()
+{
+#ifdef DIMAGESCALER_AVX2
+    if (qCpuHasFeature(AVX2))
+    {
+        return accumulateRowAvx2;
+    }
+#endif
+
+#if defined(__SSE2__)
+    return accumulateRowSse2;
+#elif defined(DIMAGESCALER_NEON)
+    return accumulateRowNeon;
+#else
+    return accumulateRowScalar;
+#endif
+}
+
+// 将每 kx 个像素的和乘以 scale 后写入一个目标像素，四个通道同时计算
+static void reduceRow(const quint32 *sums, uchar *target, int width, int kx, float scale)
+{
+#if defined(__SSE2__)
+    const __m128 factor = _mm_set1_ps(scale);
+    const __m128i zero = _mm_setzero_si128();
+
+    for (int x = 0; x < width; ++x)
+    {
+        const quint32 *pixel = sums + x * kx * 4;
+        __m128i sum = _mm_setzero_si128();
+
+        for (int i = 0; i < kx; ++i)
+        {
+            sum = _mm_add_epi32(sum, _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixel + i * 4)));
+        }
+
+        const __m128i value = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(sum), factor));
+        const int packed = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(value, zero), zero));
+
+        memcpy(target + x * 4, &packed, 4);
+    }
+#elif defined(DIMAGESCALER_NEON)
+    const float32x4_t half = vdupq_n_f32(0.5f);
+
+    for (int x = 0; x < width; ++x)
+    {
+        const quint32 *pixel = sums + x * kx * 4;
+        uint32x4_t sum = vdupq_n_u32(0);
+
+        for (int i = 0; i < kx; ++i)
+        {
+            sum = vaddq_u32(sum, vld1q_u32(pixel + i * 4));
+        }
+
+        const uint32x4_t value = vcvtq_u32_f32(vaddq_f32(vmulq_n_f32(vcvtq_f32_u32(sum), scale), half));
+        const uint16x4_t narrow = vmovn_u32(value);
+
+        vst1_lane_u32(reinterpret_cast<uint32_t *>(target + x * 4), vreinterpret_u32_u8(vmovn_u16(vcombine_u16(narrow, narrow))), 0);
+    }
+#else
+    for (int x = 0; x < width; ++x)
+    {
+        const quint32 *pixel = sums + x * kx * 4;
+
+        for (int c = 0; c < 4; ++c)
+        {
+            quint32 sum = 0;
+
+            for (int i = 0; i < kx; ++i)
+            {
+                sum += pixel[i * 4 + c];
+            }
+
+            target[x * 4 + c] = static_cast<uchar>(sum * scale + 0.5f);
+        }
+    }
+#endif
+}
+
+/*
+ * 返回按面积平均缩小后的图片，size 大于原图时使用 QImage::scaled 放大。
+ * 结果为 ARGB32_Premultiplied（有透明通道时）或 RGB32 格式
+ */
+QImage DImageScaler::scaled(const QImage &image, const QSize &size, Qt::AspectRatioMode mode)
+{
+    if (image.isNull())
+    {
+        return QImage();
+    }
+
+    const QSize &targetSize = image.size().scaled(size, mode);
+
+    if (targetSize.isEmpty())
+    {
+        return QImage();
+    }
+
+    if (targetSize == image.size())
+    {
+        return image;
+    }
+
+    if (targetSize.width() > image.width() || targetSize.height() > image.height())
+    {
+        return image.scaled(targetSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    }
+
+    // 预乘透明度后各通道可以直接平均
+    const QImage::Format format = image.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32;
+    const QImage &source = image.format() == format ? image : image.convertToFormat(format);
+    const int kx = source.width() / targetSize.width();
+    const int ky = source.height() / targetSize.height();
+    QImage reduced = source;
+
+    if (kx > 1 || ky > 1)
+    {
+        reduce(source, &reduced, kx, ky);
+    }
+
+    QImage result = reduced;
+
+    if (reduced.size() != targetSize)
+    {
+        result = QImage(targetSize, format);
+
+        if (!reduced.isNull() && !result.isNull())
+        {
+            resample(reduced, &result);
+        }
+    }
+
+    // 内存不足时交给 Qt 处理
+    if (result.isNull())
+    {
+        return image.scaled(targetSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    }
+
+    result.setDevicePixelRatio(image.devicePixelRatio());
+
+    return result;
+}
+
+void DImageScaler::reduce(const QImage &src, QImage *dst, int kx, int ky)
+{
+    static const AccumulateRow accumulateRow = accumulateRowFunction();
+
+    const int width = src.width() / kx;
+    const int height = src.height() / ky;
+    const int count = width * kx * 4;
+    const float scale = 1.0f / (kx * ky);
+    QVector<quint32> sums(count);
+
+    *dst = QImage(width, height, src.format());
+
+    if (dst->isNull())
+    {
+        return;
+    }
+
+    for (int y = 0; y < height; ++y)
+    {
+        sums.fill(0);
+
+        for (int i = 0; i < ky; ++i)
+        {
+            accumulateRow(sums.data(), src.constScanLine(y * ky + i), count);
+        }
+
+        reduceRow(sums.constData(), dst->scanLine(y), width, kx, scale);
+    }
+}
+
+void DImageScaler::resample(const QImage &src, QImage *dst)
+{
+    // 每个目标像素覆盖的源像素范围及各源像素所占的面积比例
+    struct Span
+    {
+        int first;
+        int count;
+        int offset;
+    };
+
+    auto spans = [] (int sourceLength, int targetLength, QVector<Span> *spans, QVector<float> *weights) {
+        const double scale = double(sourceLength) / targetLength;
+
+        for (int i = 0; i < targetLength; ++i)
+        {
+            const double start = i * scale;
+            const double end = qMin<double>((i + 1) * scale, sourceLength);
+            const int first = static_cast<int>(start);
+            const int last = qMin(sourceLength, static_cast<int>(std::ceil(end)));
+
+            spans->append({first, last - first, weights->size()});
+
+            for (int j = first; j < last; ++j)
+            {
+                weights->append(static_cast<float>((qMin(end, j + 1.0) - qMax(start, double(j))) / scale));
+            }
+        }
+    };
+
+    const int width = dst->width();
+    const int height = dst->height();
+    QVector<Span> columns, rows;
+    QVector<float> columnWeights, rowWeights;
+
+    spans(src.width(), width, &columns, &columnWeights);
+    spans(src.height(), height, &rows, &rowWeights);
+
+    // 先横向缩小每一行，再纵向合并
+    QVector<float> horizontal(width * 4 * src.height());
+
+    for (int y = 0; y < src.height(); ++y)
+    {
+        const uchar *line = src.constScanLine(y);
+        float *output = horizontal.data() + y * width * 4;
+
+        for (int x = 0; x < width; ++x)
+        {
+            const Span &span = columns.at(x);
+            float sum[4] = {0, 0, 0, 0};
+
+            for (int i = 0; i < span.count; ++i)
+            {
+                const uchar *pixel = line + (span.first + i) * 4;
+                const float weight = columnWeights.at(span.offset + i);
+
+                for (int c = 0; c < 4; ++c)
+                {
+                    sum[c] += pixel[c] * weight;
+                }
+            }
+
+            memcpy(output + x * 4, sum, sizeof(sum));
+        }
+    }
+
+    for (int y = 0; y < height; ++y)
+    {
+        const Span &span = rows.at(y);
+        uchar *line = dst->scanLine(y);
+
+        for (int i = 0; i < width * 4; ++i)
+        {
+            float sum = 0;
+
+            for (int j = 0; j < span.count; ++j)
+            {
+                sum += horizontal.at((span.first + j) * width * 4 + i) * rowWeights.at(span.offset + j);
+            }
+
+            line[i] = static_cast<uchar>(qBound(0.0f, sum + 0.5f, 255.0f));
+        }
+    }
+}
+
+DGUI_END_NAMESPACE
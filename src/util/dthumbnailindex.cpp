@@ -0,0 +1,548 @@
+/*
+ * Copyright (C) 2017 ~ 2017 Deepin Technology Co., Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "private/dthumbnailindex_p.h"
+
+#include <QAtomicInteger>
+#include <QDir>
+#include <QThread>
+#include <QtEndian>
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <sys/file.h>
+
+DGUI_BEGIN_NAMESPACE
+
+#define INDEX_FILE_NAME ".dtkgui-index"
+#define INDEX_MAGIC "DTKTHIDX"
+#define INDEX_VERSION 1
+// 初始容量，已使用的条目超过容量的 3/4 时扩容为原来的两倍
+#define INDEX_DEFAULT_CAPACITY (1 << 14)
+#define INDEX_MAX_PROBE 64
+#define INDEX_MAX_READ_RETRY 128
+#define INDEX_HASH_SIZE 16
+
+struct DThumbnailIndex::Header
+{
+    char magic[8];
+    quint32 version;
+    quint32 capacity;
+    // 索引文件被其它进程替换后置为1，映射了此文件的进程需要重新打开
+    QBasicAtomicInteger<quint32> obsolete;
+    quint32 count;
+    char reserved[40];
+};
+
+struct DThumbnailIndex::Record
+{
+    // 写入过程中为奇数
+    QBasicAtomicInteger<quint32> sequence;
+    quint32 state;
+    uchar hash[INDEX_HASH_SIZE];
+    qint64 mtime;
+    qint64 size;
+};
+
+DThumbnailIndex::DThumbnailIndex(const QString &directory)
+    : directory(directory)
+{
+
+}
+
+DThumbnailIndex::~DThumbnailIndex()
+{
+    close();
+}
+
+QString DThumbnailIndex::fileName() const
+{
+    return directory + QDir::separator() + INDEX_FILE_NAME;
+}
+
+/*
+ * 不加进程间锁读取条目，返回的状态为 Unknown 时表示索引中没有记录或暂时无法读取
+ */
+DThumbnailIndex::Entry DThumbnailIndex::find(const QByteArray &hash) const
+{
+    Entry entry;
+
+    if (hash.size() != INDEX_HASH_SIZE)
+    {
+        return entry;
+    }
+
+    QReadLocker locker(&mapLock);
+
+    if (!data || header()->obsolete.loadAcquire())
+    {
+        locker.unlock();
+
+        QWriteLocker writeLocker(&mapLock);
+        DThumbnailIndex *that = const_cast<DThumbnailIndex *>(this);
+
+        if (data && header()->obsolete.loadAcquire())
+        {
+            that->close();
+        }
+
+        if (!data && !that->open())
+        {
+            return entry;
+        }
+
+        writeLocker.unlock();
+        locker.relock();
+
+        if (!data)
+        {
+            return entry;
+        }
+    }
+
+    const quint32 mask = header()->capacity - 1;
+    quint32 slot = qFromLittleEndian<quint32>(reinterpret_cast<const uchar *>(hash.constData())) & mask;
+    const Record *recordList = records();
+
+    for (int i = 0; i < INDEX_MAX_PROBE; ++i, slot = (slot + 1) & mask)
+    {
+        const Record &record = recordList[slot];
+        quint32 state = Unknown;
+        uchar recordHash[INDEX_HASH_SIZE];
+        qint64 mtime = 0;
+        qint64 size = 0;
+
+        for (int retry = 0; ; ++retry)
+        {
+            // 写入者可能已经崩溃，不再等待
+            if (retry >= INDEX_MAX_READ_RETRY)
+            {
+                return entry;
+            }
+
+            const quint32 sequence = record.sequence.loadAcquire();
+
+            if (sequence & 1)
+            {
+                QThread::yieldCurrentThread();
+                continue;
+            }
+
+            state = record.state;
+            memcpy(recordHash, record.hash, INDEX_HASH_SIZE);
+            mtime = record.mtime;
+            size = record.size;
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (record.sequence.loadAcquire() == sequence)
+            {
+                break;
+            }
+        }
+
+        if (state == Unknown)
+        {
+            break;
+        }
+
+        if (memcmp(recordHash, hash.constData(), INDEX_HASH_SIZE) == 0)
+        {
+            entry.hash = hash;
+            entry.state = static_cast<State>(state);
+            entry.mtime = mtime;
+            entry.size = size;
+
+            break;
+        }
+    }
+
+    return entry;
+}
+
+bool DThumbnailIndex::insert(const QByteArray &hash, DThumbnailIndex::State state, qint64 mtime, qint64 size)
+{
+    if (hash.size() != INDEX_HASH_SIZE)
+    {
+        return false;
+    }
+
+    QWriteLocker locker(&mapLock);
+    Q_UNUSED(locker)
+
+    if (!lock())
+    {
+        return false;
+    }
+
+    Header *h = header();
+    Record *record = probe(records(), h->capacity, hash, true);
+
+    if (!record || (record->state == Unknown && h->count >= h->capacity / 4 * 3))
+    {
+        QList<Entry> list = entries();
+        Entry entry;
+
+        entry.hash = hash;
+        entry.state = state;
+        entry.mtime = mtime;
+        entry.size = size;
+        list.append(entry);
+
+        // 替换索引文件后进程间锁随旧文件一起释放
+        return rewrite(list, h->capacity * 2);
+    }
+
+    if (record->state == Unknown)
+    {
+        ++h->count;
+    }
+
+    write(record, hash, state, mtime, size);
+    unlock();
+
+    return true;
+}
+
+bool DThumbnailIndex::remove(const QByteArray &hash)
+{
+    if (hash.size() != INDEX_HASH_SIZE)
+    {
+        return false;
+    }
+
+    QWriteLocker locker(&mapLock);
+    Q_UNUSED(locker)
+
+    if (!lock())
+    {
+        return false;
+    }
+
+    Record *record = probe(records(), header()->capacity, hash, false);
+
+    if (record)
+    {
+        write(record, hash, Removed, 0, 0);
+    }
+
+    unlock();
+
+    return record;
+}
+
+/*
+ * 以给定的条目重建索引文件，用于从缩略图目录恢复索引
+ */
+bool DThumbnailIndex::reset(const QList<DThumbnailIndex::Entry> &entries)
+{
+    QWriteLocker locker(&mapLock);
+    Q_UNUSED(locker)
+
+    if (!lock())
+    {
+        return false;
+    }
+
+    return rewrite(entries, INDEX_DEFAULT_CAPACITY);
+}
+
+DThumbnailIndex::Header *DThumbnailIndex::header() const
+{
+    return reinterpret_cast<Header *>(data);
+}
+
+DThumbnailIndex::Record *DThumbnailIndex::records() const
+{
+    return reinterpret_cast<Record *>(data + sizeof(Header));
+}
+
+bool DThumbnailIndex::open()
+{
+    Q_STATIC_ASSERT(sizeof(Header) == 64);
+    Q_STATIC_ASSERT(sizeof(Record) == 40);
+
+    if (!QDir(directory).mkpath("."))
+    {
+        return false;
+    }
+
+    file.setFileName(fileName());
+
+    if (!file.open(QIODevice::ReadWrite))
+    {
+        return false;
+    }
+
+    if (flock(file.handle(), LOCK_EX) != 0)
+    {
+        file.close();
+
+        return false;
+    }
+
+    // 新创建的文件还没有被任何进程映射，可以直接初始化
+    if (file.size() == 0)
+    {
+        Header h;
+
+        memset(&h, 0, sizeof(Header));
+        memcpy(h.magic, INDEX_MAGIC, sizeof(h.magic));
+        h.version = INDEX_VERSION;
+        h.capacity = INDEX_DEFAULT_CAPACITY;
+
+        if (file.write(reinterpret_cast<const char *>(&h), sizeof(Header)) != sizeof(Header)
+                || !file.resize(sizeof(Header) + qint64(INDEX_DEFAULT_CAPACITY) * sizeof(Record)))
+        {
+            file.resize(0);
+            flock(file.handle(), LOCK_UN);
+            file.close();
+
+            return false;
+        }
+    }
+
+    data = file.size() >= qint64(sizeof(Header)) ? file.map(0, file.size()) : nullptr;
+
+    if (data)
+    {
+        const Header *h = header();
+        const bool valid = memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic)) == 0
+                && h->version == INDEX_VERSION
+                && h->capacity > 0 && (h->capacity & (h->capacity - 1)) == 0
+                && file.size() == qint64(sizeof(Header)) + qint64(h->capacity) * qint64(sizeof(Record));
+
+        if (valid)
+        {
+            flock(file.handle(), LOCK_UN);
+
+            return true;
+        }
+
+        file.unmap(data);
+        data = nullptr;
+    }
+
+    // 文件已损坏或版本不同，不能在原文件上修改，以免其它进程访问到被截断的映射
+    if (rewrite(QList<Entry>(), INDEX_DEFAULT_CAPACITY))
+    {
+        return data;
+    }
+
+    flock(file.handle(), LOCK_UN);
+    file.close();
+
+    return false;
+}
+
+void DThumbnailIndex::close()
+{
+    if (data)
+    {
+        file.unmap(data);
+        data = nullptr;
+    }
+
+    file.close();
+}
+
+/*
+ * 获取进程间的写锁，若索引文件已被其它进程替换则重新打开
+ */
+bool DThumbnailIndex::lock()
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        if (!data && !open())
+        {
+            return false;
+        }
+
+        if (flock(file.handle(), LOCK_EX) != 0)
+        {
+            return false;
+        }
+
+        if (!header()->obsolete.loadAcquire())
+        {
+            return true;
+        }
+
+        flock(file.handle(), LOCK_UN);
+        close();
+    }
+
+    return false;
+}
+
+void DThumbnailIndex::unlock()
+{
+    flock(file.handle(), LOCK_UN);
+}
+
+/*
+ * 在持有进程间写锁时调用：写入新的索引文件并替换旧文件，之后重新打开。
+ * 调用结束后进程间写锁已被释放
+ */
+bool DThumbnailIndex::rewrite(const QList<DThumbnailIndex::Entry> &entries, quint32 capacity)
+{
+    while (capacity / 4 * 3 <= quint32(entries.size()))
+    {
+        capacity *= 2;
+    }
+
+    QFile newFile(fileName() + ".new");
+
+    if (!newFile.open(QIODevice::ReadWrite | QIODevice::Truncate)
+            || !newFile.resize(sizeof(Header) + qint64(capacity) * sizeof(Record)))
+    {
+        newFile.remove();
+        unlock();
+
+        return false;
+    }
+
+    uchar *newData = newFile.map(0, newFile.size());
+
+    if (!newData)
+    {
+        newFile.remove();
+        unlock();
+
+        return false;
+    }
+
+    Header *h = reinterpret_cast<Header *>(newData);
+    Record *recordList = reinterpret_cast<Record *>(newData + sizeof(Header));
+
+    memcpy(h->magic, INDEX_MAGIC, sizeof(h->magic));
+    h->version = INDEX_VERSION;
+    h->capacity = capacity;
+
+    for (const Entry &entry : entries)
+    {
+        Record *record = probe(recordList, capacity, entry.hash, true);
+
+        if (!record)
+        {
+            continue;
+        }
+
+        if (record->state == Unknown)
+        {
+            ++h->count;
+        }
+
+        write(record, entry.hash, entry.state, entry.mtime, entry.size);
+    }
+
+    newFile.unmap(newData);
+    newFile.close();
+
+    if (::rename(QFile::encodeName(newFile.fileName()).constData(), QFile::encodeName(fileName()).constData()) != 0)
+    {
+        newFile.remove();
+        unlock();
+
+        return false;
+    }
+
+    if (data)
+    {
+        header()->obsolete.storeRelease(1);
+    }
+
+    close();
+
+    return open();
+}
+
+QList<DThumbnailIndex::Entry> DThumbnailIndex::entries() const
+{
+    QList<Entry> list;
+    const Record *recordList = records();
+
+    for (quint32 i = 0; i < header()->capacity; ++i)
+    {
+        const Record &record = recordList[i];
+
+        if (record.state != Valid && record.state != Failed)
+        {
+            continue;
+        }
+
+        Entry entry;
+
+        entry.hash = QByteArray(reinterpret_cast<const char *>(record.hash), INDEX_HASH_SIZE);
+        entry.state = static_cast<State>(record.state);
+        entry.mtime = record.mtime;
+        entry.size = record.size;
+        list.append(entry);
+    }
+
+    return list;
+}
+
+/*
+ * 线性探测查找条目，forInsert 为 true 时在找不到对应条目的情况下返回第一个空位
+ */
+DThumbnailIndex::Record *DThumbnailIndex::probe(DThumbnailIndex::Record *records, quint32 capacity, const QByteArray &hash, bool forInsert)
+{
+    if (hash.size() != INDEX_HASH_SIZE)
+    {
+        return nullptr;
+    }
+
+    const quint32 mask = capacity - 1;
+    quint32 slot = qFromLittleEndian<quint32>(reinterpret_cast<const uchar *>(hash.constData())) & mask;
+
+    for (int i = 0; i < INDEX_MAX_PROBE; ++i, slot = (slot + 1) & mask)
+    {
+        Record *record = &records[slot];
+
+        if (record->state == Unknown)
+        {
+            return forInsert ? record : nullptr;
+        }
+
+        if (memcmp(record->hash, hash.constData(), INDEX_HASH_SIZE) == 0)
+        {
+            return record;
+        }
+    }
+
+    return nullptr;
+}
+
+void DThumbnailIndex::write(DThumbnailIndex::Record *record, const QByteArray &hash, DThumbnailIndex::State state, qint64 mtime, qint64 size)
+{
+    // 崩溃的写入者可能留下奇数的序列号，此处总是从奇数开始
+    const quint32 sequence = record->sequence.loadAcquire() | 1;
+
+    record->sequence.storeRelease(sequence);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    memcpy(record->hash, hash.constData(), INDEX_HASH_SIZE);
+    record->state = state;
+    record->mtime = mtime;
+    record->size = size;
+
+    record->sequence.storeRelease(sequence + 1);
+}
+
+DGUI_END_NAMESPACE
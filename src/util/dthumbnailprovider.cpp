@@ -16,373 +16,3417 @@
  */
 
 #include "dthumbnailprovider.h"
-#include <DObjectPrivate>
-
+#include "private/dthumbnailprovider_p.h"
+#include "private/dimagescaler_p.h"
+#include "private/dthumbnailindex_p.h"
+#include "private/dthumbnailservice_p.h"
+#include "private/dthumbnailstatistics_p.h"
+
+#include <QBuffer>
+#include <QCoreApplication>
 #include <QCryptographicHash>
 #include <QDir>
 #include <QDateTime>
+#include <QDeadlineTimer>
+#include <QDirIterator>
+#include <QElapsedTimer>
 #include <QImageReader>
-#include <QQueue>
+#include <QImageWriter>
 #include <QMimeType>
-#include <QMimeDatabase>
-#include <QReadWriteLock>
-#include <QWaitCondition>
 #include <QPainter>
+#include <QSaveFile>
+#include <QSocketNotifier>
+#include <QtMath>
+#include <QStandardPaths>
+#include <QThreadStorage>
+#include <QTimer>
 #include <QUrl>
+#include <QtEndian>
 #include <QDebug>
 
 #include <DStandardPaths>
 
+#include <algorithm>
+
+#ifdef Q_OS_LINUX
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 DGUI_BEGIN_NAMESPACE
 
 #define FORMAT ".png"
 #define THUMBNAIL_PATH \
     DCORE_NAMESPACE::DStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + "/thumbnails"
 #define THUMBNAIL_FAIL_PATH THUMBNAIL_PATH"/fail"
+#define THUMBNAIL_XXLARGE_PATH THUMBNAIL_PATH"/xx-large"
+#define THUMBNAIL_XLARGE_PATH THUMBNAIL_PATH"/x-large"
 #define THUMBNAIL_LARGE_PATH THUMBNAIL_PATH"/large"
 #define THUMBNAIL_NORMAL_PATH THUMBNAIL_PATH"/normal"
 #define THUMBNAIL_SMALL_PATH THUMBNAIL_PATH"/small"
 
+// 跨进程生成权的锁文件所在目录（位于 XDG_RUNTIME_DIR 中）及等待时间
+#define THUMBNAIL_CLAIM_DIR "/dtkgui-thumbnail-claims"
+#define THUMBNAIL_CLAIM_TIMEOUT 30000
+#define THUMBNAIL_CLAIM_POLL_INTERVAL 20
+
+// 每个工作线程保留的解码缓冲区数量
+#define IMAGE_BUFFER_POOL_SIZE 4
+
+// 缓存的 MIME 类型检测结果数量
+#define MIME_CACHE_SIZE 4096
+
+// 内存中记录的失败文件数量及记录的默认有效时间
+#define KNOWN_FAILURE_CACHE_SIZE 4096
+#define KNOWN_FAILURE_TIMEOUT (5 * 60 * 1000)
+
+// 生成队列中预读的源文件数量，以及每个文件预读的长度上限
+#define READAHEAD_COUNT 4
+#define READAHEAD_LIMIT (16 * 1024 * 1024)
+
+// 文本数据块的长度上限，超过时视为损坏的文件
+#define PNG_TEXT_CHUNK_LIMIT (64 * 1024)
+
+// ioprio_set 的参数，glibc 未提供对应的头文件
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+
 inline QByteArray dataToMd5Hex(const QByteArray &data)
 {
     return QCryptographicHash::hash(data, QCryptographicHash::Md5).toHex();
 }
 
-#ifndef UT_DThumbnailProviderPrivate
-class DThumbnailProviderPrivate : public DTK_CORE_NAMESPACE::DObjectPrivate
+static QByteArray pngInflate(const QByteArray &data)
 {
-public:
-    explicit DThumbnailProviderPrivate(DThumbnailProvider *qq);
+    // qUncompress 需要4字节的长度前缀，长度不足时其内部会自动扩大缓冲区
+    QByteArray buffer(4, 0);
+    qToBigEndian<quint32>(data.size() * 4, reinterpret_cast<uchar *>(buffer.data()));
 
-    void init();
+    return qUncompress(buffer + data);
+}
 
-    QString sizeToFilePath(DThumbnailProvider::Size size) const;
+/*
+ * 以流的方式读取 PNG 文件中的文本数据块（tEXt/zTXt/iTXt），跳过像素数据不做解码，
+ * 读取到 keys 中的全部字段或遇到 IEND 时结束。文件无法打开或不是 PNG 文件时返回 false
+ */
+static bool readPngText(const QString &fileName, const QStringList &keys, QHash<QString, QString> *texts)
+{
+    QFile file(fileName);
 
-    QString errorString;
-    // MAX
-    qint64 defaultSizeLimit = INT64_MAX;
-    QHash<QMimeType, qint64> sizeLimitHash;
-    QMimeDatabase mimeDatabase;
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
 
-    static QSet<QString> hasThumbnailMimeHash;
+    static const char pngSignature[] = "\x89PNG\r\n\x1a\n";
 
-    struct ProduceInfo
+    if (file.read(8) != QByteArray::fromRawData(pngSignature, 8))
     {
-        QFileInfo fileInfo;
-        DThumbnailProvider::Size size;
-        DThumbnailProvider::CallBack callback;
-    };
+        return false;
+    }
 
-    QQueue<ProduceInfo> produceQueue;
-    QSet<QPair<QString, DThumbnailProvider::Size>> discardedProduceInfos;
+    Q_FOREVER
+    {
+        uchar header[8];
 
-    bool running = true;
+        if (file.read(reinterpret_cast<char *>(header), 8) != 8)
+        {
+            break;
+        }
 
-    QWaitCondition waitCondition;
-    QReadWriteLock dataReadWriteLock;
+        const quint32 length = qFromBigEndian<quint32>(header);
+        const QByteArray type(reinterpret_cast<const char *>(header + 4), 4);
 
-    D_DECLARE_PUBLIC(DThumbnailProvider)
-};
-#endif
+        if (type == "IEND")
+        {
+            break;
+        }
 
-QSet<QString> DThumbnailProviderPrivate::hasThumbnailMimeHash;
+        if (length > PNG_TEXT_CHUNK_LIMIT || (type != "tEXt" && type != "zTXt" && type != "iTXt"))
+        {
+            // 跳过数据块内容及其 CRC
+            if (!file.seek(file.pos() + length + 4))
+            {
+                break;
+            }
 
-DThumbnailProviderPrivate::DThumbnailProviderPrivate(DThumbnailProvider *qq)
-    : DObjectPrivate(qq)
-{
+            continue;
+        }
+
+        const QByteArray data = file.read(length);
+
+        if (data.size() != static_cast<int>(length) || file.read(4).size() != 4)
+        {
+            break;
+        }
+
+        const int keyEnd = data.indexOf('\0');
+
+        if (keyEnd <= 0)
+        {
+            continue;
+        }
+
+        const QString key = QString::fromLatin1(data.constData(), keyEnd);
+
+        if (!keys.contains(key))
+        {
+            continue;
+        }
+
+        if (type == "tEXt")
+        {
+            texts->insert(key, QString::fromLatin1(data.mid(keyEnd + 1)));
+        }
+        else if (type == "zTXt")
+        {
+            // 关键字后为1字节的压缩方式
+            texts->insert(key, QString::fromLatin1(pngInflate(data.mid(keyEnd + 2))));
+        }
+        else
+        {
+            // iTXt: 压缩标志、压缩方式、语言标签、翻译后的关键字，之后为 UTF-8 文本
+            const int languageEnd = data.indexOf('\0', keyEnd + 3);
+            const int translatedKeyEnd = languageEnd < 0 ? -1 : data.indexOf('\0', languageEnd + 1);
+
+            if (translatedKeyEnd < 0)
+            {
+                continue;
+            }
 
+            const QByteArray &text = data.mid(translatedKeyEnd + 1);
+            texts->insert(key, QString::fromUtf8(data.at(keyEnd + 1) ? pngInflate(text) : text));
+        }
+
+        if (texts->size() == keys.size())
+        {
+            break;
+        }
+    }
+
+    return true;
 }
 
-void DThumbnailProviderPrivate::init()
+QImage DImageBufferPool::acquire(const QSize &size, QImage::Format format)
 {
+    for (int i = 0; i < buffers.size(); ++i)
+    {
+        if (buffers.at(i).size() == size && buffers.at(i).format() == format)
+        {
+            return buffers.takeAt(i);
+        }
+    }
 
+    return QImage();
 }
 
-QString DThumbnailProviderPrivate::sizeToFilePath(DThumbnailProvider::Size size) const
+void DImageBufferPool::release(QImage &&image)
 {
-    switch (size)
+    // 仍与其它对象共享数据的图片不能复用
+    if (image.isNull() || !image.isDetached())
     {
-    case DThumbnailProvider::Small:
-        return THUMBNAIL_SMALL_PATH;
-    case DThumbnailProvider::Normal:
-        return THUMBNAIL_NORMAL_PATH;
-    case DThumbnailProvider::Large:
-        return THUMBNAIL_LARGE_PATH;
+        return;
     }
 
-    return QString();
+    buffers.prepend(std::move(image));
+
+    while (buffers.size() > IMAGE_BUFFER_POOL_SIZE)
+    {
+        buffers.removeLast();
+    }
 }
 
-class DFileThumbnailProviderPrivate : public DThumbnailProvider {};
-Q_GLOBAL_STATIC(DFileThumbnailProviderPrivate, ftpGlobal)
+// 按从小到大的顺序排列的全部尺寸
+static const QList<DThumbnailProvider::Size> &thumbnailSizes()
+{
+    static const QList<DThumbnailProvider::Size> sizes {
+        DThumbnailProvider::Small,
+        DThumbnailProvider::Normal,
+        DThumbnailProvider::Large,
+        DThumbnailProvider::XLarge,
+        DThumbnailProvider::XXLarge
+    };
 
-DThumbnailProvider *DThumbnailProvider::instance()
+    return sizes;
+}
+
+static DImageBufferPool &bufferPool()
 {
-    return ftpGlobal;
+    static QThreadStorage<DImageBufferPool> pools;
+
+    return pools.localData();
 }
 
-/*!
- * \~chinese \brief DThumbnailProvider::hasThumbnail缩略图是否存在
- * \~chinese \param info文件信息
- * \~chinese \return true存在　false不存在
+/*
+ * 保存缩略图及其文本信息。文本通过 QImageWriter 写入，不会因 QImage::setText 复制图片数据。
+ * 写入耗时及写入的字节数记录在 statistics 中
  */
-bool DThumbnailProvider::hasThumbnail(const QFileInfo &info) const
+static bool saveThumbnail(const QImage &image, const QString &fileName, const QString &url, qint64 mtime, qint64 size,
+                          DThumbnailStatistics *statistics)
 {
-    Q_D(const DThumbnailProvider);
+    QElapsedTimer timer;
 
-    if (!info.isReadable() || !info.isFile())
+    timer.start();
+
+    // 先写入临时文件再重命名，其它进程不会读到不完整的缩略图
+    QSaveFile file(fileName);
+
+    if (!file.open(QIODevice::WriteOnly))
     {
         return false;
     }
 
-    qint64 fileSize = info.size();
+    QImageWriter writer(&file, QFileInfo(fileName).suffix().toLatin1());
 
-    if (fileSize <= 0)
+    writer.setQuality(80);
+    writer.setText(QT_STRINGIFY(Thumb::URL), url);
+    writer.setText(QT_STRINGIFY(Thumb::MTime), QString::number(mtime));
+
+    // 数据来自顺序设备时大小未知
+    if (size >= 0)
+    {
+        writer.setText(QT_STRINGIFY(Thumb::Size), QString::number(size));
+    }
+
+    if (!writer.write(image))
     {
+        file.cancelWriting();
+
         return false;
     }
 
-    const QMimeType &mime = d->mimeDatabase.mimeTypeForFile(info);
+    const qint64 bytes = file.size();
 
-    if (fileSize > sizeLimit(mime))
+    if (!file.commit())
     {
         return false;
     }
 
-    return hasThumbnail(mime);
+    statistics->recordWrite(timer.nsecsElapsed());
+    statistics->add(DThumbnailStatistics::BytesWritten, bytes);
+
+    return true;
 }
 
-bool DThumbnailProvider::hasThumbnail(const QMimeType &mimeType) const
+/*
+ * 磁盘上的失败标记有效时更新索引，使其与之一致
+ */
+static void refreshFailIndex(DThumbnailIndex *failIndex, const QByteArray &urlHash, qint64 mtime, qint64 size)
 {
-    const QString &mime = mimeType.name();
+    if (!failIndex)
+    {
+        return;
+    }
 
-    if (DThumbnailProviderPrivate::hasThumbnailMimeHash.isEmpty())
+    const DThumbnailIndex::Entry &entry = failIndex->find(urlHash);
+
+    if (entry.state != DThumbnailIndex::Failed || entry.mtime != mtime)
+    {
+        failIndex->insert(urlHash, DThumbnailIndex::Failed, mtime, size);
+    }
+}
+
+/*
+ * 通知内核预读即将处理的源文件，读取在后台进行，不会阻塞当前的解码。按 inode 排序后再发出请求，
+ * 同一目录中的文件在磁盘上的位置通常与 inode 顺序接近，可以减少机械硬盘的寻道
+ */
+static void readaheadFiles(const QStringList &files)
+{
+#ifdef Q_OS_LINUX
+    struct SourceFile
+    {
+        int fd;
+        ino_t inode;
+        off_t size;
+    };
+
+    QList<SourceFile> sourceFiles;
+
+    for (const QString &fileName : files)
     {
-        const QList<QByteArray> &mimeTypes = QImageReader::supportedMimeTypes();
+        const int fd = ::open(QFile::encodeName(fileName).constData(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
 
-        if (mimeTypes.isEmpty())
+        if (fd < 0)
         {
-            DThumbnailProviderPrivate::hasThumbnailMimeHash.insert("");
+            continue;
+        }
 
-            return false;
+        struct stat st;
+
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            ::close(fd);
+
+            continue;
         }
 
-        DThumbnailProviderPrivate::hasThumbnailMimeHash.reserve(mimeTypes.size());
+        sourceFiles.append({fd, st.st_ino, st.st_size});
+    }
+
+    std::sort(sourceFiles.begin(), sourceFiles.end(), [] (const SourceFile &a, const SourceFile &b) {
+        return a.inode < b.inode;
+    });
+
+    for (const SourceFile &file : sourceFiles)
+    {
+        posix_fadvise(file.fd, 0, qMin<off_t>(file.size, READAHEAD_LIMIT), POSIX_FADV_WILLNEED);
+        ::close(file.fd);
+    }
+#else
+    Q_UNUSED(files)
+#endif
+}
+
+// 进程内各线程持有的生成权
+struct DThumbnailClaimRegistry
+{
+    QMutex mutex;
+    QWaitCondition released;
+    QSet<QByteArray> keys;
+};
+
+Q_GLOBAL_STATIC(DThumbnailClaimRegistry, claimRegistry)
+
+/*
+ * 主线程中不等待其它调用者的生成权，避免界面卡住
+ */
+static int claimTimeout()
+{
+    const QCoreApplication *application = QCoreApplication::instance();
+
+    return application && QThread::currentThread() == application->thread() ? 0 : THUMBNAIL_CLAIM_TIMEOUT;
+}
+
+DThumbnailClaim::DThumbnailClaim(const QByteArray &key, int timeout)
+    : key(key)
+{
+    const QDeadlineTimer deadline(timeout);
+    DThumbnailClaimRegistry *registry = claimRegistry;
+    QMutexLocker locker(&registry->mutex);
+
+    // 等待同一进程中的其它线程时不必访问锁文件，释放后立即被唤醒
+    while (registry->keys.contains(key))
+    {
+        contended = true;
 
-        for (const QByteArray &t : mimeTypes)
+        if (deadline.hasExpired() || !registry->released.wait(&registry->mutex, ulong(deadline.remainingTime())))
         {
-            DThumbnailProviderPrivate::hasThumbnailMimeHash.insert(QString::fromLocal8Bit(t));
+            return;
         }
     }
 
-    return DThumbnailProviderPrivate::hasThumbnailMimeHash.contains(mime);
+    registry->keys.insert(key);
+    registered = true;
+    locker.unlock();
+
+#ifdef Q_OS_LINUX
+    const QString &directory = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation) + THUMBNAIL_CLAIM_DIR;
+
+    fileName = QFile::encodeName(directory + QDir::separator() + QString::fromLatin1(key) + ".lock");
+
+    Q_FOREVER
+    {
+        fd = ::open(fileName.constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+        // 锁文件所在的目录只在第一次使用时创建
+        if (fd < 0 && errno == ENOENT && QDir().mkpath(directory))
+        {
+            fd = ::open(fileName.constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        }
+
+        if (fd < 0)
+        {
+            // 无法使用锁文件时只在进程内互斥
+            return;
+        }
+
+        while (flock(fd, LOCK_EX | LOCK_NB) != 0)
+        {
+            if (errno == EWOULDBLOCK)
+            {
+                contended = true;
+            }
+
+            if (errno != EWOULDBLOCK || deadline.hasExpired())
+            {
+                // 超时后不再等待，由调用者自行生成
+                ::close(fd);
+                fd = -1;
+                release();
+
+                return;
+            }
+
+            QThread::msleep(THUMBNAIL_CLAIM_POLL_INTERVAL);
+        }
+
+        // 等待期间上一个持有者可能已删除此文件，此时需要重新打开
+        struct stat fdStat;
+        struct stat pathStat;
+
+        if (fstat(fd, &fdStat) == 0 && ::stat(fileName.constData(), &pathStat) == 0
+                && fdStat.st_dev == pathStat.st_dev && fdStat.st_ino == pathStat.st_ino)
+        {
+            return;
+        }
+
+        ::close(fd);
+        fd = -1;
+    }
+#endif
 }
 
-/*!
- * \~chinese \brief DThumbnailProvider::thumbnailFilePath返回文件缩略图文件路径
- * \~chinese \param info文件信息
- * \~chinese \param size 图片大小
- * \~chinese \return 路径信息
+DThumbnailClaim::~DThumbnailClaim()
+{
+#ifdef Q_OS_LINUX
+    if (fd >= 0)
+    {
+        // 在释放锁之前删除，等待者会发现文件已被删除并重新创建
+        unlink(fileName.constData());
+        ::close(fd);
+    }
+#endif
+
+    release();
+}
+
+void DThumbnailClaim::release()
+{
+    if (!registered)
+    {
+        return;
+    }
+
+    DThumbnailClaimRegistry *registry = claimRegistry;
+    QMutexLocker locker(&registry->mutex);
+
+    registry->keys.remove(key);
+    registered = false;
+    locker.unlock();
+    registry->released.wakeAll();
+}
+
+bool DThumbnailClaim::isAcquired() const
+{
+    return registered;
+}
+
+bool DThumbnailClaim::isContended() const
+{
+    return contended;
+}
+
+/*
+ * 从 EXIF 的 TIFF 数据中取出 IFD1 记录的内嵌 JPEG 缩略图
+ */
+static QImage exifThumbnail(const QByteArray &tiff)
+{
+    const uchar *data = reinterpret_cast<const uchar *>(tiff.constData());
+    const quint64 size = tiff.size();
+    bool bigEndian = false;
+
+    if (size < 8)
+    {
+        return QImage();
+    }
+
+    if (tiff.startsWith("MM"))
+    {
+        bigEndian = true;
+    }
+    else if (!tiff.startsWith("II"))
+    {
+        return QImage();
+    }
+
+    auto read16 = [data, bigEndian] (quint64 offset) -> quint32 {
+        return bigEndian ? qFromBigEndian<quint16>(data + offset) : qFromLittleEndian<quint16>(data + offset);
+    };
+    auto read32 = [data, bigEndian] (quint64 offset) -> quint32 {
+        return bigEndian ? qFromBigEndian<quint32>(data + offset) : qFromLittleEndian<quint32>(data + offset);
+    };
+
+    const quint64 ifd0 = read32(4);
+
+    if (ifd0 + 2 > size)
+    {
+        return QImage();
+    }
+
+    const quint64 nextIfd = ifd0 + 2 + read16(ifd0) * 12;
+
+    if (nextIfd + 4 > size)
+    {
+        return QImage();
+    }
+
+    const quint64 ifd1 = read32(nextIfd);
+
+    if (ifd1 == 0 || ifd1 + 2 > size)
+    {
+        return QImage();
+    }
+
+    const quint32 count = read16(ifd1);
+    quint64 offset = 0;
+    quint64 length = 0;
+
+    for (quint32 i = 0; i < count; ++i)
+    {
+        const quint64 entry = ifd1 + 2 + i * 12;
+
+        if (entry + 12 > size)
+        {
+            break;
+        }
+
+        const quint32 tag = read16(entry);
+
+        // JPEGInterchangeFormat 与 JPEGInterchangeFormatLength
+        if (tag == 0x0201)
+        {
+            offset = read32(entry + 8);
+        }
+        else if (tag == 0x0202)
+        {
+            length = read32(entry + 8);
+        }
+    }
+
+    if (offset == 0 || length == 0 || offset + length > size)
+    {
+        return QImage();
+    }
+
+    return QImage::fromData(data + offset, static_cast<int>(length), "JPEG");
+}
+
+/*
+ * 读取 JPEG 文件 EXIF 信息（APP1）中内嵌的缩略图，只读取图像数据之前的标记段
+ */
+static QImage readExifThumbnail(const QString &fileName)
+{
+    QFile file(fileName);
+    uchar marker[4];
+
+    if (!file.open(QIODevice::ReadOnly)
+            || file.read(reinterpret_cast<char *>(marker), 2) != 2
+            || marker[0] != 0xff || marker[1] != 0xd8)
+    {
+        return QImage();
+    }
+
+    Q_FOREVER
+    {
+        if (file.read(reinterpret_cast<char *>(marker), 4) != 4 || marker[0] != 0xff)
+        {
+            return QImage();
+        }
+
+        // 已到图像数据，之后不会再有 EXIF 信息
+        if (marker[1] == 0xda || marker[1] == 0xd9)
+        {
+            return QImage();
+        }
+
+        const quint16 length = qFromBigEndian<quint16>(marker + 2);
+
+        if (length < 2)
+        {
+            return QImage();
+        }
+
+        if (marker[1] != 0xe1)
+        {
+            if (!file.seek(file.pos() + length - 2))
+            {
+                return QImage();
+            }
+
+            continue;
+        }
+
+        const QByteArray &segment = file.read(length - 2);
+
+        if (segment.size() != length - 2)
+        {
+            return QImage();
+        }
+
+        if (segment.startsWith(QByteArray("Exif\0\0", 6)))
+        {
+            return exifThumbnail(segment.mid(6));
+        }
+    }
+}
+
+/*
+ * 在 DCT 域按 1/2、1/4、1/8 缩小解码时，不小于目标大小的最小解码大小
+ */
+static QSize jpegDecodeSize(const QSize &imageSize, const QSize &targetSize)
+{
+    int denominator = 8;
+
+    while (denominator > 1
+           && (imageSize.width() / denominator < targetSize.width()
+               || imageSize.height() / denominator < targetSize.height()))
+    {
+        denominator /= 2;
+    }
+
+    return QSize(imageSize.width() / denominator, imageSize.height() / denominator);
+}
+
+/*
+ * JPEG 缩略图：EXIF 中内嵌的缩略图足够大且宽高比一致时直接使用，否则在 DCT 域按
+ * 1/2、1/4、1/8 缩小解码，最后再缩放到目标大小
+ */
+static bool readJpegThumbnail(QImageReader *reader, const QSize &imageSize, const QSize &targetSize, QImage *image)
+{
+    const QImage &exif = readExifThumbnail(reader->fileName());
+
+    if (!exif.isNull()
+            && exif.width() >= targetSize.width() && exif.height() >= targetSize.height()
+            && qAbs(qreal(exif.width()) * imageSize.height() / (qreal(exif.height()) * imageSize.width()) - 1) < 0.02)
+    {
+        *image = exif.size() == targetSize ? exif : DImageScaler::scaled(exif, targetSize);
+
+        return true;
+    }
+
+    const QSize &scaledSize = jpegDecodeSize(imageSize, targetSize);
+
+    if (scaledSize != imageSize)
+    {
+        reader->setScaledSize(scaledSize);
+    }
+
+    QImage decoded = bufferPool().acquire(scaledSize, reader->imageFormat());
+
+    if (!reader->read(&decoded))
+    {
+        return false;
+    }
+
+    if (decoded.size() != targetSize)
+    {
+        *image = DImageScaler::scaled(decoded, targetSize);
+        bufferPool().release(std::move(decoded));
+    }
+    else
+    {
+        *image = std::move(decoded);
+    }
+
+    return true;
+}
+
+class DThumbnailWorker : public QThread
+{
+public:
+    explicit DThumbnailWorker(DThumbnailProviderPrivate *d, int index)
+        : d(d)
+        , index(index)
+    {
+
+    }
+
+protected:
+    void run() Q_DECL_OVERRIDE
+    {
+        d->processProduceQueue(index);
+    }
+
+private:
+    DThumbnailProviderPrivate *d;
+    int index;
+};
+
+class DThumbnailGarbageCollector : public QThread
+{
+public:
+    explicit DThumbnailGarbageCollector(DThumbnailProviderPrivate *d)
+        : d(d)
+    {
+
+    }
+
+protected:
+    void run() Q_DECL_OVERRIDE
+    {
+        d->collectGarbage();
+    }
+
+private:
+    DThumbnailProviderPrivate *d;
+};
+
+QSet<QString> DThumbnailProviderPrivate::hasThumbnailMimeHash;
+QReadWriteLock DThumbnailProviderPrivate::hasThumbnailMimeHashLock;
+
+DThumbnailProviderPrivate::DThumbnailProviderPrivate(DThumbnailProvider *qq)
+    : DObjectPrivate(qq)
+    , knownFailureTimeout(KNOWN_FAILURE_TIMEOUT)
+    , readaheadCount(READAHEAD_COUNT)
+    , maxThreadCount(qMax(1, QThread::idealThreadCount()))
+{
+    mimeCache.setMaxCost(MIME_CACHE_SIZE);
+    knownFailures.setMaxCost(KNOWN_FAILURE_CACHE_SIZE);
+
+}
+
+DThumbnailProviderPrivate::~DThumbnailProviderPrivate()
+{
+    delete garbageCollector;
+    qDeleteAll(indexes);
+
+#ifdef Q_OS_LINUX
+    delete inotifyNotifier;
+
+    if (inotifyFd >= 0)
+    {
+        close(inotifyFd);
+    }
+#endif
+}
+
+void DThumbnailProviderPrivate::init()
+{
+
+}
+
+/*
+ * 返回缩略图目录对应的索引，未启用索引时返回空
+ */
+DThumbnailIndex *DThumbnailProviderPrivate::thumbnailIndex(const QString &directory) const
+{
+    QMutexLocker locker(&indexMutex);
+    Q_UNUSED(locker)
+
+    if (!indexEnabled)
+    {
+        return nullptr;
+    }
+
+    DThumbnailIndex *&index = indexes[directory];
+
+    if (!index)
+    {
+        index = new DThumbnailIndex(directory);
+    }
+
+    return index;
+}
+
+void DThumbnailProviderPrivate::setErrorString(const QString &error)
+{
+    QMutexLocker locker(&errorStringMutex);
+    Q_UNUSED(locker)
+
+    errorString = error;
+}
+
+void DThumbnailProviderPrivate::startWorkers()
+{
+    // 第0个工作线程为 DThumbnailProvider 自身，由调用者负责启动
+    const int count = qMin(maxThreadCount, activeWorkers + produceQueue.size()) - 1;
+
+    for (int i = 0; i < count; ++i)
+    {
+        if (i >= workers.size())
+        {
+            workers.append(new DThumbnailWorker(this, i + 1));
+        }
+
+        // 正在退出的线程 isRunning 仍为 true，等其结束后重新启动
+        if (exitingWorkers.remove(i + 1))
+        {
+            workers.at(i)->wait();
+        }
+
+        if (!workers.at(i)->isRunning())
+        {
+            workers.at(i)->start();
+        }
+    }
+}
+
+/*
+ * 加入生成队列，与队列中的相同任务合并，生成结束后一并回调。相同任务正在生成时，
+ * 其读取的可能是修改前的源文件，新的请求记录下来等其结束后重新生成
+ */
+void DThumbnailProviderPrivate::enqueue(ProduceInfo &&info)
+{
+    const ProduceKey key(info.fileInfo.absoluteFilePath(), info.size);
+    auto inFlight = inFlightTasks.find(key);
+
+    if (inFlight != inFlightTasks.end())
+    {
+        if (!inFlight->pendingRequests.isEmpty())
+        {
+            ++mergedProduceCount;
+        }
+
+        inFlight->pendingRequests.append(info.requests);
+        inFlight->priority = qMax(inFlight->priority, info.priority);
+
+        return;
+    }
+
+    auto queued = produceOrders.find(key);
+
+    if (queued != produceOrders.end())
+    {
+        ProduceInfo existing = produceQueue.take(queued.value());
+
+        existing.requests.append(info.requests);
+        existing.priority = qMax(existing.priority, info.priority);
+        existing.rerun = existing.rerun || info.rerun;
+        info = std::move(existing);
+        ++mergedProduceCount;
+    }
+
+    const ProduceOrder order(info.priority, ++produceSequence);
+
+    produceOrders.insert(key, order);
+    produceQueue.insert(order, std::move(info));
+}
+
+/*
+ * 移除最近加入的一个请求，其回调不再调用，合并在同一任务中的其它请求不受影响。
+ * 任务不再有请求时取消；正在进行的解码无法中止，结束后只发出信号
+ */
+void DThumbnailProviderPrivate::discard(const ProduceKey &key)
+{
+    auto inFlight = inFlightTasks.find(key);
+
+    if (inFlight != inFlightTasks.end())
+    {
+        QList<ProduceRequest> &requests = inFlight->pendingRequests.isEmpty() ? inFlight->requests
+                                                                              : inFlight->pendingRequests;
+
+        if (!requests.isEmpty())
+        {
+            requests.removeLast();
+        }
+
+        if (inFlight->requests.isEmpty() && inFlight->pendingRequests.isEmpty())
+        {
+            discardedProduceInfos.insert(key);
+        }
+
+        return;
+    }
+
+    auto queued = produceOrders.find(key);
+
+    if (queued != produceOrders.end())
+    {
+        QList<ProduceRequest> &requests = produceQueue[queued.value()].requests;
+
+        if (!requests.isEmpty())
+        {
+            requests.removeLast();
+        }
+
+        if (!requests.isEmpty())
+        {
+            return;
+        }
+    }
+
+    discardedProduceInfos.insert(key);
+}
+
+DThumbnailProviderPrivate::ProduceInfo DThumbnailProviderPrivate::dequeue()
+{
+    auto last = std::prev(produceQueue.end());
+    ProduceInfo info = std::move(last.value());
+
+    produceOrders.remove(qMakePair(info.fileInfo.absoluteFilePath(), info.size));
+    produceQueue.erase(last);
+    readaheadSources.remove(info.fileInfo.absoluteFilePath());
+
+    return info;
+}
+
+/*
+ * 返回队列中接下来将要处理且尚未预读的源文件，调用时需持有 dataReadWriteLock
+ */
+QStringList DThumbnailProviderPrivate::takeReadaheadFiles()
+{
+    QStringList files;
+    auto it = produceQueue.end();
+
+    for (int i = 0; i < readaheadCount && it != produceQueue.begin(); ++i)
+    {
+        const QString &fileName = (--it).value().fileInfo.absoluteFilePath();
+
+        if (!readaheadSources.contains(fileName))
+        {
+            readaheadSources.insert(fileName);
+            files.append(fileName);
+        }
+    }
+
+    return files;
+}
+
+void DThumbnailProviderPrivate::processProduceQueue(int workerIndex)
+{
+    D_Q(DThumbnailProvider);
+
+    Q_FOREVER
+    {
+        QWriteLocker locker(&dataReadWriteLock);
+
+        while (running && workerIndex < maxThreadCount && produceQueue.isEmpty())
+        {
+            waitCondition.wait(&dataReadWriteLock);
+        }
+
+        if (!running || workerIndex >= maxThreadCount)
+        {
+            exitingWorkers.insert(workerIndex);
+
+            return;
+        }
+
+        ProduceInfo task = dequeue();
+        const ProduceKey &tmpKey = qMakePair(task.fileInfo.absoluteFilePath(), task.size);
+
+        if (discardedProduceInfos.contains(tmpKey))
+        {
+            discardedProduceInfos.remove(tmpKey);
+            locker.unlock();
+            continue;
+        }
+
+        InFlightTask &inFlight = inFlightTasks[tmpKey];
+
+        inFlight.requests = task.requests;
+        inFlight.priority = task.priority;
+        ++activeWorkers;
+
+        const QStringList &readahead = takeReadaheadFiles();
+        QList<DThumbnailProvider::PreviewCallBack> previewCallbacks;
+
+        for (const ProduceRequest &request : task.requests)
+        {
+            if (request.previewCallback)
+            {
+                previewCallbacks.append(request.previewCallback);
+            }
+        }
+
+        const bool progressive = progressiveEnabled || !previewCallbacks.isEmpty();
+
+        locker.unlock();
+
+        // 生成当前缩略图的同时由内核读取之后的源文件
+        readaheadFiles(readahead);
+
+        QString errorString;
+        ProduceResult result;
+
+        // 重新生成时源文件可能并未再改变，缩略图仍有效时直接使用
+        if (task.rerun)
+        {
+            task.fileInfo.refresh();
+            result.thumbnail = q->thumbnailFilePath(task.fileInfo, task.size);
+        }
+
+        if (result.thumbnail.isEmpty())
+        {
+            if (progressive)
+            {
+                const QImage &preview = createPreview(task.fileInfo, task.size);
+
+                if (!preview.isNull())
+                {
+                    deliverPreview(task.fileInfo.absoluteFilePath(), preview, previewCallbacks);
+                }
+            }
+
+            result.thumbnail = createThumbnail(task.fileInfo, task.size, errorString, &result.notifications);
+        }
+
+        locker.relock();
+
+        const InFlightTask finished = inFlightTasks.take(tmpKey);
+
+        // 所有请求都已在生成期间移除时 discard 记录的标记已无用，不再保留
+        discardedProduceInfos.remove(tmpKey);
+
+        for (const ProduceRequest &request : finished.requests)
+        {
+            if (request.callback)
+            {
+                result.callbacks.append(request.callback);
+            }
+        }
+
+        if (!finished.pendingRequests.isEmpty())
+        {
+            ProduceInfo rerun;
+
+            rerun.fileInfo = task.fileInfo;
+            rerun.size = task.size;
+            rerun.requests = finished.pendingRequests;
+            rerun.priority = finished.priority;
+            rerun.rerun = true;
+            enqueue(std::move(rerun));
+        }
+
+        --activeWorkers;
+        locker.unlock();
+
+        // 未设置接收对象时直接在工作线程中通知
+        if (!postResult(result))
+        {
+            deliverResult(result);
+        }
+    }
+}
+
+/*
+ * 发出缩略图生成结束的信号，notifications 不为空时只记录下来由调用者稍后发出
+ */
+void DThumbnailProviderPrivate::notify(const QString &sourceFilePath, const QString &thumbnail, QList<Notification> *notifications)
+{
+    D_Q(DThumbnailProvider);
+
+    if (notifications)
+    {
+        notifications->append(qMakePair(sourceFilePath, thumbnail));
+
+        return;
+    }
+
+    if (thumbnail.isEmpty())
+    {
+        Q_EMIT q->createThumbnailFailed(sourceFilePath);
+    }
+    else
+    {
+        Q_EMIT q->createThumbnailFinished(sourceFilePath, thumbnail);
+        Q_EMIT q->thumbnailChanged(sourceFilePath, thumbnail);
+    }
+}
+
+/*
+ * 预览与最终结果在同一线程中按顺序送达
+ */
+void DThumbnailProviderPrivate::deliverPreview(const QString &sourceFilePath, const QImage &preview, const QList<DThumbnailProvider::PreviewCallBack> &callbacks)
+{
+    D_Q(DThumbnailProvider);
+
+    auto deliver = [q, sourceFilePath, preview, callbacks] {
+        for (const DThumbnailProvider::PreviewCallBack &callback : callbacks)
+        {
+            callback(preview);
+        }
+
+        Q_EMIT q->thumbnailPreviewReady(sourceFilePath, preview);
+    };
+
+    QMutexLocker locker(&deliveryMutex);
+
+    if (deliveryTarget)
+    {
+        QMetaObject::invokeMethod(deliveryTarget.data(), deliver, Qt::QueuedConnection);
+
+        return;
+    }
+
+    locker.unlock();
+    deliver();
+}
+
+void DThumbnailProviderPrivate::deliverResult(const ProduceResult &result)
+{
+    for (const Notification &notification : result.notifications)
+    {
+        notify(notification.first, notification.second);
+    }
+
+    for (const DThumbnailProvider::CallBack &callback : result.callbacks)
+    {
+        callback(result.thumbnail);
+    }
+}
+
+/*
+ * 将结果交给接收对象所在的线程，同一次事件循环中的结果合并为一批处理
+ */
+bool DThumbnailProviderPrivate::postResult(const ProduceResult &result)
+{
+    QMutexLocker locker(&deliveryMutex);
+
+    if (!deliveryTarget)
+    {
+        return false;
+    }
+
+    pendingResults.append(result);
+
+    if (!deliveryScheduled)
+    {
+        deliveryScheduled = true;
+        QMetaObject::invokeMethod(deliveryTarget.data(), [this] {
+            deliverPendingResults();
+        }, Qt::QueuedConnection);
+    }
+
+    return true;
+}
+
+void DThumbnailProviderPrivate::deliverPendingResults()
+{
+    D_Q(DThumbnailProvider);
+
+    QMutexLocker locker(&deliveryMutex);
+    QList<ProduceResult> results;
+
+    results.swap(pendingResults);
+    deliveryScheduled = false;
+    locker.unlock();
+
+    if (results.isEmpty())
+    {
+        return;
+    }
+
+    QStringList sourceFilePaths;
+    QStringList thumbnailPaths;
+
+    for (const ProduceResult &result : results)
+    {
+        deliverResult(result);
+
+        for (const Notification &notification : result.notifications)
+        {
+            sourceFilePaths.append(notification.first);
+            thumbnailPaths.append(notification.second);
+        }
+    }
+
+    Q_EMIT q->createThumbnailsBatchFinished(sourceFilePaths, thumbnailPaths);
+}
+
+/*
+ * 清理缩略图目录：删除源文件已不存在的缩略图，超出容量上限时按最近访问时间从旧到新删除
+ */
+void DThumbnailProviderPrivate::collectGarbage()
+{
+    D_Q(DThumbnailProvider);
+
+#if defined(Q_OS_LINUX) && defined(SYS_ioprio_set)
+    // 以空闲的 IO 优先级访问磁盘，不影响其它读写
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+#endif
+
+    struct CacheFile
+    {
+        QString fileName;
+        qint64 size;
+        qint64 accessTime;
+    };
+
+    const QList<DThumbnailProvider::Size> &sizes = thumbnailSizes();
+    qint64 reclaimedBytes = 0;
+    int removedCount = 0;
+    bool canceled = false;
+
+    auto removeFile = [&] (const QString &directory, const CacheFile &file) {
+        if (!QFile::remove(file.fileName))
+        {
+            return;
+        }
+
+        if (DThumbnailIndex *index = thumbnailIndex(directory))
+        {
+            index->remove(QByteArray::fromHex(QFileInfo(file.fileName).completeBaseName().toLatin1()));
+        }
+
+        reclaimedBytes += file.size;
+        ++removedCount;
+    };
+
+    // 失败记录所在的目录没有容量上限，只清理源文件已不存在的记录
+    for (int i = 0; i <= sizes.size(); ++i)
+    {
+        const QString &directory = i < sizes.size() ? sizeToFilePath(sizes.at(i)) : QString(THUMBNAIL_FAIL_PATH);
+        QMutexLocker locker(&cacheMutex);
+        const CacheLimit limit = i < sizes.size() ? cacheLimits.value(sizes.at(i)) : CacheLimit();
+        locker.unlock();
+
+        QList<CacheFile> files;
+        qint64 totalBytes = 0;
+        QDirIterator iterator(directory, {QStringLiteral("*" FORMAT)}, QDir::Files);
+
+        while (iterator.hasNext())
+        {
+            // 被取消时仍发出结束信号，已删除的文件计入结果
+            if (garbageCollectionCanceled.loadAcquire())
+            {
+                canceled = true;
+                break;
+            }
+
+            const QString &fileName = iterator.next();
+            const QFileInfo &fileInfo = iterator.fileInfo();
+            // 文件系统使用 relatime 时访问时间可能早于修改时间
+            const CacheFile file {fileName, fileInfo.size(),
+                                  qMax(fileInfo.lastRead(), fileInfo.lastModified()).toMSecsSinceEpoch()};
+            QHash<QString, QString> texts;
+
+            if (readPngText(fileName, {QT_STRINGIFY(Thumb::URL)}, &texts))
+            {
+                const QUrl url(texts.value(QT_STRINGIFY(Thumb::URL)));
+
+                if (url.isLocalFile() && !QFile::exists(url.toLocalFile()))
+                {
+                    removeFile(directory, file);
+
+                    continue;
+                }
+            }
+
+            files.append(file);
+            totalBytes += file.size;
+        }
+
+        if (canceled)
+        {
+            break;
+        }
+
+        if ((limit.bytes <= 0 || totalBytes <= limit.bytes) && (limit.entries <= 0 || files.size() <= limit.entries))
+        {
+            continue;
+        }
+
+        std::sort(files.begin(), files.end(), [] (const CacheFile &a, const CacheFile &b) {
+            return a.accessTime < b.accessTime;
+        });
+
+        int entryCount = files.size();
+
+        for (const CacheFile &file : files)
+        {
+            if ((limit.bytes <= 0 || totalBytes <= limit.bytes) && (limit.entries <= 0 || entryCount <= limit.entries))
+            {
+                break;
+            }
+
+            totalBytes -= file.size;
+            --entryCount;
+            removeFile(directory, file);
+        }
+    }
+
+    Q_EMIT q->garbageCollectionFinished(reclaimedBytes, removedCount);
+}
+
+void DThumbnailProviderPrivate::readWatchEvents()
+{
+#ifdef Q_OS_LINUX
+    alignas(struct inotify_event) char buffer[4096];
+    QSet<QString> changedFiles;
+    ssize_t length;
+    QMutexLocker locker(&watchMutex);
+
+    while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0)
+    {
+        for (char *p = buffer; p < buffer + length;)
+        {
+            const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(p);
+
+            p += sizeof(struct inotify_event) + event->len;
+
+            // 目录被删除或不再监视
+            if (event->mask & IN_IGNORED)
+            {
+                watchedDirectories.remove(event->wd);
+
+                continue;
+            }
+
+            if (event->len == 0 || (event->mask & IN_ISDIR) || !watchedDirectories.contains(event->wd))
+            {
+                continue;
+            }
+
+            changedFiles.insert(watchedDirectories.value(event->wd) + QDir::separator() + QFile::decodeName(event->name));
+        }
+    }
+
+    locker.unlock();
+
+    // 同一文件的多个事件只处理一次
+    for (const QString &filePath : changedFiles)
+    {
+        invalidateThumbnails(filePath);
+    }
+#endif
+}
+
+/*
+ * 源文件被修改或删除后删除其过期的缩略图及失败记录，发出 thumbnailChanged 信号，文件仍存在时重新加入生成队列
+ */
+void DThumbnailProviderPrivate::invalidateThumbnails(const QString &sourceFilePath)
+{
+    D_Q(DThumbnailProvider);
+
+    const QFileInfo info(sourceFilePath);
+    const QString fileUrl = QUrl::fromLocalFile(info.absoluteFilePath()).toString(QUrl::FullyEncoded);
+    const QByteArray &urlHash = QCryptographicHash::hash(fileUrl.toLocal8Bit(), QCryptographicHash::Md5);
+    const QString thumbnailName = urlHash.toHex() + FORMAT;
+    const bool exists = info.exists();
+    const qint64 mtime = exists ? info.lastModified().toTime_t() : 0;
+    const QList<DThumbnailProvider::Size> &sizes = thumbnailSizes();
+    QList<DThumbnailProvider::Size> staleSizes;
+    bool changed = false;
+
+    {
+        QMutexLocker locker(&knownFailuresMutex);
+        Q_UNUSED(locker)
+
+        knownFailures.remove(info.absoluteFilePath());
+    }
+
+    for (int i = 0; i <= sizes.size(); ++i)
+    {
+        const QString &directory = i < sizes.size() ? sizeToFilePath(sizes.at(i)) : QString(THUMBNAIL_FAIL_PATH);
+        const QString &thumbnail = directory + QDir::separator() + thumbnailName;
+        QHash<QString, QString> texts;
+
+        if (!readPngText(thumbnail, {QT_STRINGIFY(Thumb::MTime)}, &texts))
+        {
+            continue;
+        }
+
+        // 只修改了权限等属性时缩略图仍然有效
+        if (exists && texts.value(QT_STRINGIFY(Thumb::MTime)).toLongLong() == mtime)
+        {
+            continue;
+        }
+
+        QFile::remove(thumbnail);
+
+        if (DThumbnailIndex *index = thumbnailIndex(directory))
+        {
+            index->remove(urlHash);
+        }
+
+        if (i < sizes.size())
+        {
+            staleSizes.append(sizes.at(i));
+        }
+
+        changed = true;
+    }
+
+    if (!changed)
+    {
+        return;
+    }
+
+    Q_EMIT q->thumbnailChanged(info.absoluteFilePath(), QString());
+
+    if (!exists)
+    {
+        return;
+    }
+
+    for (DThumbnailProvider::Size size : staleSizes)
+    {
+        q->appendToProduceQueue(info, size);
+    }
+}
+
+/*
+ * 检测文件的 MIME 类型。按内容检测的结果以文件的设备号、inode、修改时间及大小为键缓存，
+ * 位于 extensionOnlyMimeDirectories 中的文件只按扩展名检测
+ */
+QMimeType DThumbnailProviderPrivate::mimeTypeForFile(const QFileInfo &info) const
+{
+    const QString &absoluteFilePath = info.absoluteFilePath();
+    QReadLocker locker(&mimeDirectoriesLock);
+    const QStringList directories = extensionOnlyMimeDirectories;
+
+    locker.unlock();
+
+    for (const QString &directory : directories)
+    {
+        if (absoluteFilePath.startsWith(directory + QDir::separator()))
+        {
+            const QMimeType &mimeType = mimeDatabase.mimeTypeForFile(info, QMimeDatabase::MatchExtension);
+
+            // 没有扩展名或扩展名未知时仍按内容检测
+            if (!mimeType.isDefault())
+            {
+                return mimeType;
+            }
+
+            break;
+        }
+    }
+
+#ifdef Q_OS_LINUX
+    struct stat st;
+
+    if (::stat(QFile::encodeName(absoluteFilePath).constData(), &st) != 0)
+    {
+        return mimeDatabase.mimeTypeForFile(info);
+    }
+
+    MimeCacheKey key;
+
+    key.device = st.st_dev;
+    key.inode = st.st_ino;
+    key.mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    key.size = st.st_size;
+
+    QMutexLocker cacheLocker(&mimeCacheMutex);
+
+    if (const QMimeType *mimeType = mimeCache.object(key))
+    {
+        return *mimeType;
+    }
+
+    cacheLocker.unlock();
+
+    const QMimeType &mimeType = mimeDatabase.mimeTypeForFile(info);
+
+    cacheLocker.relock();
+    mimeCache.insert(key, new QMimeType(mimeType));
+
+    return mimeType;
+#else
+    return mimeDatabase.mimeTypeForFile(info);
+#endif
+}
+
+/*
+ * 文件是否支持生成缩略图，mimeType 不为空时返回检测到的 MIME 类型，供之后生成缩略图时使用
+ */
+bool DThumbnailProviderPrivate::hasThumbnail(const QFileInfo &info, QMimeType *mimeType) const
+{
+    D_QC(DThumbnailProvider);
+
+    if (!info.isReadable() || !info.isFile())
+    {
+        return false;
+    }
+
+    qint64 fileSize = info.size();
+
+    if (fileSize <= 0)
+    {
+        return false;
+    }
+
+    const QMimeType &mime = mimeTypeForFile(info);
+
+    if (mimeType)
+    {
+        *mimeType = mime;
+    }
+
+    if (fileSize > q->sizeLimit(mime))
+    {
+        return false;
+    }
+
+    return q->hasThumbnail(mime);
+}
+
+/*
+ * 文件在有效时间内已确认不支持或生成失败，且之后没有被修改
+ */
+bool DThumbnailProviderPrivate::isKnownFailure(const QFileInfo &info, qint64 mtime, QString *errorString) const
+{
+    QMutexLocker locker(&knownFailuresMutex);
+    Q_UNUSED(locker)
+
+    const KnownFailure *failure = knownFailures.object(info.absoluteFilePath());
+
+    if (!failure || failure->mtime != mtime || failure->size != info.size()
+            || failure->expiration < QDateTime::currentMSecsSinceEpoch())
+    {
+        return false;
+    }
+
+    *errorString = failure->errorString;
+
+    return true;
+}
+
+void DThumbnailProviderPrivate::addKnownFailure(const QFileInfo &info, qint64 mtime, const QString &errorString)
+{
+    QMutexLocker locker(&knownFailuresMutex);
+    Q_UNUSED(locker)
+
+    if (knownFailureTimeout <= 0)
+    {
+        return;
+    }
+
+    KnownFailure *failure = new KnownFailure;
+
+    failure->mtime = mtime;
+    failure->size = info.size();
+    failure->expiration = QDateTime::currentMSecsSinceEpoch() + knownFailureTimeout;
+    failure->errorString = errorString;
+    knownFailures.insert(info.absoluteFilePath(), failure);
+}
+
+/*
+ * 影响文件能否生成缩略图的设置改变后，之前的记录不再可靠
+ */
+void DThumbnailProviderPrivate::clearKnownFailures()
+{
+    QMutexLocker locker(&knownFailuresMutex);
+    Q_UNUSED(locker)
+
+    knownFailures.clear();
+}
+
+/*
+ * 读取文件的缩略图图片，缩略图不存在时先生成
+ */
+QImage DThumbnailProviderPrivate::loadThumbnailImage(const QString &filePath, int size, QString *errorString)
+{
+    D_Q(DThumbnailProvider);
+
+    const DThumbnailProvider::Size thumbnailSize = static_cast<DThumbnailProvider::Size>(size);
+
+    if (sizeToFilePath(thumbnailSize).isEmpty())
+    {
+        *errorString = QStringLiteral("Invalid thumbnail size: ") + QString::number(size);
+
+        return QImage();
+    }
+
+    const QFileInfo info(filePath);
+    QString thumbnail = q->thumbnailFilePath(info, thumbnailSize);
+
+    if (thumbnail.isEmpty())
+    {
+        thumbnail = createThumbnail(info, thumbnailSize, *errorString);
+    }
+
+    if (thumbnail.isEmpty())
+    {
+        return QImage();
+    }
+
+    QImage image(thumbnail);
+
+    if (image.isNull())
+    {
+        *errorString = QStringLiteral("Can not read thumbnail ") + thumbnail;
+    }
+
+    return image;
+}
+
+/*
+ * 依次尝试已缓存的其它尺寸、JPEG 内嵌的 EXIF 缩略图以及按1/8大小解码 JPEG，都不可用或缩略图已存在时返回空图片。
+ * 预览不会保存到缓存目录中
+ */
+QImage DThumbnailProviderPrivate::createPreview(const QFileInfo &info, DThumbnailProvider::Size size) const
+{
+    D_QC(DThumbnailProvider);
+
+    if (!q->thumbnailFilePath(info, size).isEmpty())
+    {
+        return QImage();
+    }
+
+    const QSize maxSize(size, size);
+    const QList<DThumbnailProvider::Size> &sizes = thumbnailSizes();
+    const int index = sizes.indexOf(size);
+    QList<DThumbnailProvider::Size> cachedSizes;
+
+    // 优先使用更大的尺寸，缩小后的质量更好
+    for (int i = index + 1; i < sizes.size(); ++i)
+    {
+        cachedSizes.append(sizes.at(i));
+    }
+
+    for (int i = index - 1; i >= 0; --i)
+    {
+        cachedSizes.append(sizes.at(i));
+    }
+
+    for (DThumbnailProvider::Size cachedSize : cachedSizes)
+    {
+        const QString &thumbnail = q->thumbnailFilePath(info, cachedSize);
+        QImage image;
+
+        if (!thumbnail.isEmpty() && image.load(thumbnail))
+        {
+            return image.width() > size || image.height() > size
+                    ? DImageScaler::scaled(image, maxSize, Qt::KeepAspectRatio) : image;
+        }
+    }
+
+    if (mimeTypeForFile(info).name() != QLatin1String("image/jpeg"))
+    {
+        return QImage();
+    }
+
+    const QImage &exif = readExifThumbnail(info.absoluteFilePath());
+
+    if (!exif.isNull())
+    {
+        return exif.width() > size || exif.height() > size
+                ? DImageScaler::scaled(exif, maxSize, Qt::KeepAspectRatio) : exif;
+    }
+
+    QImageReader reader(info.absoluteFilePath());
+    const QSize &imageSize = reader.size();
+
+    if (!imageSize.isValid())
+    {
+        return QImage();
+    }
+
+    const QSize &targetSize = imageSize.width() > size || imageSize.height() > size
+            ? imageSize.scaled(maxSize, Qt::KeepAspectRatio) : imageSize;
+    const QSize previewSize(imageSize.width() / 8, imageSize.height() / 8);
+
+    // 最终的解码已经是1/8大小时预览并不会更快
+    if (previewSize.isEmpty() || jpegDecodeSize(imageSize, targetSize) == previewSize)
+    {
+        return QImage();
+    }
+
+    QReadLocker locker(&sizeLimitLock);
+    const qint64 memoryLimit = decodeMemoryLimit;
+    locker.unlock();
+
+    if (memoryLimit > 0 && qint64(previewSize.width()) * previewSize.height() * 4 > memoryLimit)
+    {
+        return QImage();
+    }
+
+    reader.setScaledSize(previewSize);
+
+    const QImage &preview = reader.read();
+
+    return preview.width() > size || preview.height() > size
+            ? DImageScaler::scaled(preview, maxSize, Qt::KeepAspectRatio) : preview;
+}
+
+QString DThumbnailProviderPrivate::sizeToFilePath(DThumbnailProvider::Size size) const
+{
+    switch (size)
+    {
+    case DThumbnailProvider::Small:
+        return THUMBNAIL_SMALL_PATH;
+    case DThumbnailProvider::Normal:
+        return THUMBNAIL_NORMAL_PATH;
+    case DThumbnailProvider::Large:
+        return THUMBNAIL_LARGE_PATH;
+    case DThumbnailProvider::XLarge:
+        return THUMBNAIL_XLARGE_PATH;
+    case DThumbnailProvider::XXLarge:
+        return THUMBNAIL_XXLARGE_PATH;
+    }
+
+    return QString();
+}
+
+/*
+ * 是否为缩略图目录，其中的文件本身就是缩略图
+ */
+bool DThumbnailProviderPrivate::isThumbnailDirectory(const QString &path) const
+{
+    if (path == THUMBNAIL_FAIL_PATH)
+    {
+        return true;
+    }
+
+    for (DThumbnailProvider::Size size : thumbnailSizes())
+    {
+        if (path == sizeToFilePath(size))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+class DFileThumbnailProviderPrivate : public DThumbnailProvider {};
+Q_GLOBAL_STATIC(DFileThumbnailProviderPrivate, ftpGlobal)
+
+DThumbnailProvider *DThumbnailProvider::instance()
+{
+    return ftpGlobal;
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::hasThumbnail缩略图是否存在
+ * \~chinese \param info文件信息
+ * \~chinese \return true存在　false不存在
+ */
+bool DThumbnailProvider::hasThumbnail(const QFileInfo &info) const
+{
+    Q_D(const DThumbnailProvider);
+
+    return d->hasThumbnail(info);
+}
+
+bool DThumbnailProvider::hasThumbnail(const QMimeType &mimeType) const
+{
+    Q_D(const DThumbnailProvider);
+
+    const QString &mime = mimeType.name();
+
+    if (d->externalThumbnailer.supports(mime))
+    {
+        return true;
+    }
+
+    // 工作线程与调用者线程可能同时访问，在此延迟初始化时需要加锁
+    QReadLocker readLocker(&DThumbnailProviderPrivate::hasThumbnailMimeHashLock);
+
+    if (DThumbnailProviderPrivate::hasThumbnailMimeHash.isEmpty())
+    {
+        readLocker.unlock();
+        QWriteLocker writeLocker(&DThumbnailProviderPrivate::hasThumbnailMimeHashLock);
+
+        if (DThumbnailProviderPrivate::hasThumbnailMimeHash.isEmpty())
+        {
+            const QList<QByteArray> &mimeTypes = QImageReader::supportedMimeTypes();
+
+            if (mimeTypes.isEmpty())
+            {
+                DThumbnailProviderPrivate::hasThumbnailMimeHash.insert("");
+
+                return false;
+            }
+
+            DThumbnailProviderPrivate::hasThumbnailMimeHash.reserve(mimeTypes.size());
+
+            for (const QByteArray &t : mimeTypes)
+            {
+                DThumbnailProviderPrivate::hasThumbnailMimeHash.insert(QString::fromLocal8Bit(t));
+            }
+        }
+
+        return DThumbnailProviderPrivate::hasThumbnailMimeHash.contains(mime);
+    }
+
+    return DThumbnailProviderPrivate::hasThumbnailMimeHash.contains(mime);
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::thumbnailFilePath返回文件缩略图文件路径
+ * \~chinese \param info文件信息
+ * \~chinese \param size 图片大小
+ * \~chinese \return 路径信息
+ */
+QString DThumbnailProvider::thumbnailFilePath(const QFileInfo &info, Size size) const
+{
+    Q_D(const DThumbnailProvider);
+
+    const QString &absolutePath = info.absolutePath();
+    const QString &absoluteFilePath = info.absoluteFilePath();
+
+    if (d->isThumbnailDirectory(absolutePath))
+    {
+        return absoluteFilePath;
+    }
+
+    return d->findThumbnail(QUrl::fromLocalFile(absoluteFilePath).toString(QUrl::FullyEncoded), absoluteFilePath,
+                            info.lastModified().toTime_t(), info.size(), size);
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::thumbnailFilePath返回以 cacheKey 标识的数据的缩略图文件路径
+ * \~chinese \param cacheKey 生成缩略图时使用的键
+ * \~chinese \param mtime 数据的修改时间，单位为秒，与缩略图中记录的不一致时缩略图已过期
+ * \~chinese \param size 图片大小
+ * \~chinese \return 路径信息，缩略图不存在或已过期时为空
+ * \~chinese \sa createThumbnail(QIODevice *, const QString &, qint64, Size)
+ */
+QString DThumbnailProvider::thumbnailFilePath(const QString &cacheKey, qint64 mtime, Size size) const
+{
+    Q_D(const DThumbnailProvider);
+
+    return d->findThumbnail(cacheKey, cacheKey, mtime, -1, size);
+}
+
+/*
+ * 查找 url 对应的缩略图并校验修改时间，缩略图已过期时将其删除并以 sourceFilePath 发出 thumbnailChanged 信号
+ */
+QString DThumbnailProviderPrivate::findThumbnail(const QString &url, const QString &sourceFilePath, qint64 mtime,
+                                                 qint64 sourceSize, DThumbnailProvider::Size size) const
+{
+    D_QC(DThumbnailProvider);
+
+    const QByteArray &md5Hex = dataToMd5Hex(url.toLocal8Bit());
+    const QString thumbnailName = md5Hex + FORMAT;
+    QString thumbnail = sizeToFilePath(size) + QDir::separator() + thumbnailName;
+    DThumbnailIndex *index = thumbnailIndex(sizeToFilePath(size));
+    bool indexed = false;
+
+    // 索引只是提示：不使用索引的进程可能已改写了缩略图，因此命中时只确认文件存在，
+    // 修改时间不一致时仍以缩略图中记录的为准
+    if (index)
+    {
+        const DThumbnailIndex::Entry &entry = index->find(QByteArray::fromHex(md5Hex));
+
+        if (entry.state == DThumbnailIndex::Valid)
+        {
+            if (entry.mtime == mtime && QFile::exists(thumbnail))
+            {
+                statistics.add(DThumbnailStatistics::CacheHits);
+
+                return thumbnail;
+            }
+
+            indexed = true;
+        }
+    }
+
+    QHash<QString, QString> texts;
+
+    // 只读取文本数据块校验修改时间，不解码缩略图
+    if (!readPngText(thumbnail, {QT_STRINGIFY(Thumb::MTime)}, &texts))
+    {
+        if (indexed)
+        {
+            index->remove(QByteArray::fromHex(md5Hex));
+        }
+
+        statistics.add(DThumbnailStatistics::CacheMisses);
+
+        return QString();
+    }
+
+    if (texts.value(QT_STRINGIFY(Thumb::MTime)).toInt() != (int)mtime)
+    {
+        statistics.add(DThumbnailStatistics::CacheStale);
+        QFile::remove(thumbnail);
+
+        if (index)
+        {
+            index->remove(QByteArray::fromHex(md5Hex));
+        }
+
+        Q_EMIT q->thumbnailChanged(sourceFilePath, QString());
+
+        return QString();
+    }
+
+    if (index)
+    {
+        index->insert(QByteArray::fromHex(md5Hex), DThumbnailIndex::Valid, mtime, qMax<qint64>(0, sourceSize));
+    }
+
+    statistics.add(DThumbnailStatistics::CacheHits);
+
+    return thumbnail;
+}
+
+QString DThumbnailProviderPrivate::createThumbnail(const QFileInfo &info, DThumbnailProvider::Size size, QString &errorString, QList<Notification> *notifications, QSize *sourceSize)
+{
+    return createThumbnails(info, {size}, errorString, notifications, sourceSize).first();
+}
+
+/*
+ * 生成多个尺寸的缩略图：源文件只按最大的尺寸解码一次，较小的尺寸由解码结果缩小得到。
+ * 返回的列表与 sizes 一一对应，生成失败的尺寸对应空字符串
+ */
+QStringList DThumbnailProviderPrivate::createThumbnails(const QFileInfo &info, const QList<DThumbnailProvider::Size> &sizes, QString &errorString, QList<Notification> *notifications, QSize *sourceSize)
+{
+    D_Q(DThumbnailProvider);
+
+    errorString.clear();
+
+    const QString &absolutePath = info.absolutePath();
+    const QString &absoluteFilePath = info.absoluteFilePath();
+    QStringList thumbnails;
+
+    if (isThumbnailDirectory(absolutePath))
+    {
+        for (int i = 0; i < sizes.size(); ++i)
+        {
+            thumbnails.append(absoluteFilePath);
+        }
+
+        return thumbnails;
+    }
+
+    for (int i = 0; i < sizes.size(); ++i)
+    {
+        thumbnails.append(QString());
+    }
+
+    if (sizes.isEmpty())
+    {
+        return thumbnails;
+    }
+
+    const qint64 mtime = info.lastModified().toTime_t();
+
+    // 已知失败的文件只需查找一次内存中的记录
+    if (isKnownFailure(info, mtime, &errorString))
+    {
+        return thumbnails;
+    }
+
+    // 只检测一次 MIME 类型，之后生成缩略图时直接使用
+    QMimeType mimeType;
+
+    if (!hasThumbnail(info, &mimeType))
+    {
+        errorString = QStringLiteral("This file has not support thumbnail: ") + absoluteFilePath;
+        addKnownFailure(info, mtime, errorString);
+
+        //!Warnning: Do not store thumbnails to the fail path
+        return thumbnails;
+    }
+
+    const QString fileUrl = QUrl::fromLocalFile(absoluteFilePath).toString(QUrl::FullyEncoded);
+    const QByteArray &urlHash = QCryptographicHash::hash(fileUrl.toLocal8Bit(), QCryptographicHash::Md5);
+    const QString thumbnailName = urlHash.toHex() + FORMAT;
+
+    // the file is in fail path
+    QString thumbnail = THUMBNAIL_FAIL_PATH + QDir::separator() + thumbnailName;
+    DThumbnailIndex *failIndex = thumbnailIndex(THUMBNAIL_FAIL_PATH);
+    QHash<QString, QString> texts;
+
+    // 失败标记可能已被不使用索引的进程删除或改写，以磁盘上的文件为准
+    if (readPngText(thumbnail, {QT_STRINGIFY(Thumb::MTime)}, &texts))
+    {
+        if (texts.value(QT_STRINGIFY(Thumb::MTime)).toInt() != (int)mtime)
+        {
+            QFile::remove(thumbnail);
+
+            if (failIndex)
+            {
+                failIndex->remove(urlHash);
+            }
+        }
+        else
+        {
+            refreshFailIndex(failIndex, urlHash, mtime, info.size());
+            addKnownFailure(info, mtime, errorString);
+
+            return thumbnails;
+        }
+    }
+    else if (failIndex && failIndex->find(urlHash).state == DThumbnailIndex::Failed)
+    {
+        failIndex->remove(urlHash);
+    }// end
+
+    // 其它线程或进程正在生成同一文件的缩略图时等待其结束，并直接使用其结果；
+    // 主线程中不等待，对方的结果尚不可用时自行生成
+    const DThumbnailClaim claim(urlHash.toHex(), claimTimeout());
+
+    if (claim.isContended())
+    {
+        texts.clear();
+
+        if (readPngText(thumbnail, {QT_STRINGIFY(Thumb::MTime)}, &texts)
+                && texts.value(QT_STRINGIFY(Thumb::MTime)).toInt() == (int)mtime)
+        {
+            addKnownFailure(info, mtime, errorString);
+
+            return thumbnails;
+        }
+
+        QStringList generated;
+
+        for (DThumbnailProvider::Size size : sizes)
+        {
+            const QString &path = sizeToFilePath(size) + QDir::separator() + thumbnailName;
+
+            texts.clear();
+
+            if (!readPngText(path, {QT_STRINGIFY(Thumb::MTime)}, &texts)
+                    || texts.value(QT_STRINGIFY(Thumb::MTime)).toInt() != (int)mtime)
+            {
+                break;
+            }
+
+            generated.append(path);
+        }
+
+        // 全部尺寸都已生成时才直接使用，否则重新生成
+        if (generated.size() == sizes.size())
+        {
+            for (const QString &path : generated)
+            {
+                notify(absoluteFilePath, path, notifications);
+            }
+
+            return generated;
+        }
+    }
+
+    const int maxSize = *std::max_element(sizes.constBegin(), sizes.constEnd());
+    QElapsedTimer decodeTimer;
+    QImage image;
+    // 解码所需的内存超出上限
+    bool overBudget = false;
+
+    decodeTimer.start();
+
+    QImageReader reader(absoluteFilePath);
+    bool useExternalThumbnailer = false;
+
+    if (!reader.canRead())
+    {
+        if (externalThumbnailer.supports(mimeType.name()))
+        {
+            useExternalThumbnailer = true;
+            image = externalThumbnailer.create(absoluteFilePath, mimeType.name(), maxSize, &errorString);
+
+            if (errorString.isEmpty() && (image.width() > maxSize || image.height() > maxSize))
+            {
+                image = DImageScaler::scaled(image, QSize(maxSize, maxSize), Qt::KeepAspectRatio);
+            }
+        }
+        else
+        {
+            reader.setFormat(mimeType.name().toLocal8Bit());
+
+            if (!reader.canRead())
+            {
+                errorString = reader.errorString();
+            }
+        }
+    }
+
+    if (errorString.isEmpty() && !useExternalThumbnailer)
+    {
+        const QSize &imageSize = reader.size();
+
+        if (sourceSize)
+        {
+            *sourceSize = imageSize;
+        }
+
+        if (imageSize.isValid())
+        {
+            const QSize &targetSize = imageSize.width() >= maxSize || imageSize.height() >= maxSize
+                    ? imageSize.scaled(maxSize, maxSize, Qt::KeepAspectRatio)
+                    : imageSize;
+            const bool isJpeg = reader.format() == "jpeg" || reader.format() == "jpg";
+            // 支持按缩小后的大小解码的格式（JPEG 在 DCT 域缩小，PNG 逐行读取并缩小）无需分配原图大小的内存
+            const QSize &decodeSize = isJpeg ? jpegDecodeSize(imageSize, targetSize)
+                                             : reader.supportsOption(QImageIOHandler::ScaledSize) ? targetSize : imageSize;
+            const int depth = reader.imageFormat() == QImage::Format_Invalid
+                    ? 32 : QImage::toPixelFormat(reader.imageFormat()).bitsPerPixel();
+            QReadLocker locker(&sizeLimitLock);
+            const qint64 memoryLimit = decodeMemoryLimit;
+            locker.unlock();
+
+            if (memoryLimit > 0 && qint64(decodeSize.width()) * decodeSize.height() * qMax(depth, 8) / 8 > memoryLimit)
+            {
+                errorString = QStringLiteral("Image is too large to decode within the memory limit: ") + absoluteFilePath;
+                overBudget = true;
+            }
+            else if (isJpeg)
+            {
+                if (!readJpegThumbnail(&reader, imageSize, targetSize, &image))
+                {
+                    errorString = reader.errorString();
+                }
+            }
+            else
+            {
+                // 不支持按缩小后的大小解码的格式按原图解码，再由 DImageScaler 缩小
+                if (decodeSize != imageSize)
+                {
+                    reader.setScaledSize(decodeSize);
+                }
+
+                // 大小与格式相同时解码器直接写入复用的缓冲区
+                image = bufferPool().acquire(decodeSize, reader.imageFormat());
+
+                if (!reader.read(&image))
+                {
+                    errorString = reader.errorString();
+                }
+                else if (image.size() != targetSize)
+                {
+                    QImage decoded = std::move(image);
+
+                    image = DImageScaler::scaled(decoded, targetSize);
+                    bufferPool().release(std::move(decoded));
+                }
+            }
+        }
+        else
+        {
+            errorString = "Fail to read image file attribute data:" + info.absoluteFilePath();
+        }
+    }
+
+    statistics.recordDecode(mimeType.name(), decodeTimer.nsecsElapsed());
+
+    // 超出内存上限与请求的尺寸及当前的上限有关，不是文件本身的问题，不记录为失败
+    if (overBudget)
+    {
+        bufferPool().release(std::move(image));
+        statistics.add(DThumbnailStatistics::ThumbnailsFailed);
+        notify(absoluteFilePath, QString(), notifications);
+
+        return thumbnails;
+    }
+
+    if (!errorString.isEmpty())
+    {
+        //fail
+        static const QImage failImage = [] {
+            QImage marker(1, 1, QImage::Format_Mono);
+            marker.fill(0);
+            return marker;
+        }();
+
+        bufferPool().release(std::move(image));
+
+        // create path
+        QFileInfo(thumbnail).absoluteDir().mkpath(".");
+
+        if (!saveThumbnail(failImage, thumbnail, fileUrl, mtime, info.size(), &statistics))
+        {
+            errorString = QStringLiteral("Can not save image to ") + thumbnail;
+        }
+        else if (failIndex)
+        {
+            failIndex->insert(urlHash, DThumbnailIndex::Failed, mtime, info.size());
+        }
+
+        statistics.add(DThumbnailStatistics::ThumbnailsFailed);
+        addKnownFailure(info, mtime, errorString);
+        notify(absoluteFilePath, QString(), notifications);
+
+        return thumbnails;
+    }
+
+    // successful
+    for (int i = 0; i < sizes.size(); ++i)
+    {
+        const DThumbnailProvider::Size size = sizes.at(i);
+        // 由最大尺寸的解码结果缩小得到，不再重复解码源文件
+        const QImage &thumbnailImage = image.width() > size || image.height() > size
+                ? DImageScaler::scaled(image, QSize(size, size), Qt::KeepAspectRatio)
+                : image;
+
+        thumbnail = sizeToFilePath(size) + QDir::separator() + thumbnailName;
+
+        // create path
+        QFileInfo(thumbnail).absoluteDir().mkpath(".");
+
+        if (!saveThumbnail(thumbnailImage, thumbnail, fileUrl, mtime, info.size(), &statistics))
+        {
+            errorString = QStringLiteral("Can not save image to ") + thumbnail;
+
+            // fail
+            notify(absoluteFilePath, QString(), notifications);
+
+            continue;
+        }
+
+        if (DThumbnailIndex *index = thumbnailIndex(sizeToFilePath(size)))
+        {
+            index->insert(urlHash, DThumbnailIndex::Valid, mtime, info.size());
+        }
+
+        thumbnails[i] = thumbnail;
+        statistics.add(DThumbnailStatistics::ThumbnailsCreated);
+
+        notify(absoluteFilePath, thumbnail, notifications);
+    }
+
+    bufferPool().release(std::move(image));
+
+    return thumbnails;
+}
+
+/*
+ * 从设备中读取数据生成缩略图，以 url 作为缓存的键，保存的位置及格式与文件的缩略图相同。
+ * 数据只读取一次，不会写入临时文件；JPEG 在 DCT 域缩小解码，但无法读取其 EXIF 中内嵌的缩略图
+ */
+QString DThumbnailProviderPrivate::createThumbnail(QIODevice *device, const QString &url, qint64 mtime, DThumbnailProvider::Size size, QString &errorString)
+{
+    errorString.clear();
+
+    if (url.isEmpty())
+    {
+        errorString = QStringLiteral("The cache key of thumbnail is empty");
+
+        return QString();
+    }
+
+    if (!device || (!device->isOpen() && !device->open(QIODevice::ReadOnly)) || !device->isReadable())
+    {
+        errorString = QStringLiteral("Can not read thumbnail source: ") + url;
+        notify(url, QString());
+
+        return QString();
+    }
+
+    const QByteArray &urlHash = QCryptographicHash::hash(url.toLocal8Bit(), QCryptographicHash::Md5);
+    const QString thumbnailName = urlHash.toHex() + FORMAT;
+    const QString failThumbnail = THUMBNAIL_FAIL_PATH + QDir::separator() + thumbnailName;
+    // 顺序设备的大小未知，不记录在缩略图中
+    const qint64 sourceSize = device->isSequential() ? -1 : device->size();
+    DThumbnailIndex *failIndex = thumbnailIndex(THUMBNAIL_FAIL_PATH);
+    QHash<QString, QString> texts;
+
+    // 失败标记以磁盘上的文件为准，索引只随之更新
+    auto isFailed = [&] {
+        texts.clear();
+
+        if (!readPngText(failThumbnail, {QT_STRINGIFY(Thumb::MTime)}, &texts))
+        {
+            if (failIndex && failIndex->find(urlHash).state == DThumbnailIndex::Failed)
+            {
+                failIndex->remove(urlHash);
+            }
+
+            return false;
+        }
+
+        if (texts.value(QT_STRINGIFY(Thumb::MTime)).toInt() != (int)mtime)
+        {
+            return false;
+        }
+
+        refreshFailIndex(failIndex, urlHash, mtime, qMax<qint64>(0, sourceSize));
+
+        return true;
+    };
+
+    if (isFailed())
+    {
+        errorString = QStringLiteral("Thumbnail of this data has failed before: ") + url;
+
+        return QString();
+    }
+
+    // 其它线程或进程正在生成同一数据的缩略图时等待其结束，并直接使用其结果；主线程中不等待
+    const DThumbnailClaim claim(urlHash.toHex(), claimTimeout());
+
+    if (claim.isContended())
+    {
+        if (isFailed())
+        {
+            errorString = QStringLiteral("Thumbnail of this data has failed before: ") + url;
+
+            return QString();
+        }
+
+        const QString &thumbnail = findThumbnail(url, url, mtime, sourceSize, size);
+
+        if (!thumbnail.isEmpty())
+        {
+            return thumbnail;
+        }
+    }
+
+    QElapsedTimer decodeTimer;
+    QImage image;
+    bool overBudget = false;
+    QImageReader reader(device);
+
+    decodeTimer.start();
+    reader.setDecideFormatFromContent(true);
+
+    const QSize &imageSize = reader.canRead() ? reader.size() : QSize();
+
+    if (!imageSize.isValid())
+    {
+        errorString = reader.errorString();
+    }
+    else
+    {
+        const QSize &targetSize = imageSize.width() >= size || imageSize.height() >= size
+                ? imageSize.scaled(size, size, Qt::KeepAspectRatio)
+                : imageSize;
+        const bool isJpeg = reader.format() == "jpeg" || reader.format() == "jpg";
+        const QSize &decodeSize = isJpeg ? jpegDecodeSize(imageSize, targetSize)
+                                         : reader.supportsOption(QImageIOHandler::ScaledSize) ? targetSize : imageSize;
+        const int depth = reader.imageFormat() == QImage::Format_Invalid
+                ? 32 : QImage::toPixelFormat(reader.imageFormat()).bitsPerPixel();
+        QReadLocker locker(&sizeLimitLock);
+        const qint64 memoryLimit = decodeMemoryLimit;
+        locker.unlock();
+
+        if (memoryLimit > 0 && qint64(decodeSize.width()) * decodeSize.height() * qMax(depth, 8) / 8 > memoryLimit)
+        {
+            errorString = QStringLiteral("Image is too large to decode within the memory limit: ") + url;
+            overBudget = true;
+        }
+        else
+        {
+            if (decodeSize != imageSize)
+            {
+                reader.setScaledSize(decodeSize);
+            }
+
+            // 大小与格式相同时解码器直接写入复用的缓冲区
+            image = bufferPool().acquire(decodeSize, reader.imageFormat());
+
+            if (!reader.read(&image))
+            {
+                errorString = reader.errorString();
+            }
+            else if (image.size() != targetSize)
+            {
+                QImage decoded = std::move(image);
+
+                image = DImageScaler::scaled(decoded, targetSize);
+                bufferPool().release(std::move(decoded));
+            }
+        }
+    }
+
+    // 没有 MIME 类型可用，按解码器的格式名记录
+    statistics.recordDecode(reader.format().isEmpty() ? QStringLiteral("application/octet-stream")
+                                                      : QStringLiteral("image/") + QString::fromLatin1(reader.format()),
+                            decodeTimer.nsecsElapsed());
+
+    // 超出内存上限不是数据本身的问题，不记录为失败
+    if (overBudget)
+    {
+        bufferPool().release(std::move(image));
+        statistics.add(DThumbnailStatistics::ThumbnailsFailed);
+        notify(url, QString());
+
+        return QString();
+    }
+
+    if (!errorString.isEmpty() || image.isNull())
+    {
+        static const QImage failImage = [] {
+            QImage marker(1, 1, QImage::Format_Mono);
+            marker.fill(0);
+            return marker;
+        }();
+
+        if (errorString.isEmpty())
+        {
+            errorString = QStringLiteral("Can not read image data: ") + url;
+        }
+
+        bufferPool().release(std::move(image));
+        QFileInfo(failThumbnail).absoluteDir().mkpath(".");
+
+        if (saveThumbnail(failImage, failThumbnail, url, mtime, sourceSize, &statistics) && failIndex)
+        {
+            failIndex->insert(urlHash, DThumbnailIndex::Failed, mtime, qMax<qint64>(0, sourceSize));
+        }
+
+        statistics.add(DThumbnailStatistics::ThumbnailsFailed);
+        notify(url, QString());
+
+        return QString();
+    }
+
+    const QString thumbnail = sizeToFilePath(size) + QDir::separator() + thumbnailName;
+
+    QFileInfo(thumbnail).absoluteDir().mkpath(".");
+
+    const bool saved = saveThumbnail(image, thumbnail, url, mtime, sourceSize, &statistics);
+
+    bufferPool().release(std::move(image));
+
+    if (!saved)
+    {
+        errorString = QStringLiteral("Can not save image to ") + thumbnail;
+        notify(url, QString());
+
+        return QString();
+    }
+
+    if (DThumbnailIndex *index = thumbnailIndex(sizeToFilePath(size)))
+    {
+        index->insert(urlHash, DThumbnailIndex::Valid, mtime, qMax<qint64>(0, sourceSize));
+    }
+
+    statistics.add(DThumbnailStatistics::ThumbnailsCreated);
+    notify(url, thumbnail);
+
+    return thumbnail;
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::createThumbnail创建缩略图
+ * \~chinese \param info 文件信息
+ * \~chinese \param size 图片大小
+ * \~chinese \return 成功返回绝对路径信息，失败则返回空
+ */
+QString DThumbnailProvider::createThumbnail(const QFileInfo &info, DThumbnailProvider::Size size)
+{
+    Q_D(DThumbnailProvider);
+
+    const ThumbnailResult &result = generateThumbnail(info, size);
+
+    d->setErrorString(result.errorString);
+
+    return result.thumbnailPath;
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::generateThumbnail创建缩略图并返回详细的结果
+ * \~chinese \param info 文件信息
+ * \~chinese \param size 图片大小
+ * \~chinese \return 缩略图路径（失败时为空）、错误信息、所用时间及源图片大小
+ * \~chinese \note 此函数是可重入的，不会修改 errorString() 等共享的状态，可在多个线程中同时调用，
+ * \~chinese 例如在 QtConcurrent 或应用自己的线程池中并行生成缩略图
+ */
+DThumbnailProvider::ThumbnailResult DThumbnailProvider::generateThumbnail(const QFileInfo &info, DThumbnailProvider::Size size)
+{
+    Q_D(DThumbnailProvider);
+
+    ThumbnailResult result;
+    QElapsedTimer timer;
+
+    timer.start();
+    result.thumbnailPath = d->createThumbnail(info, size, result.errorString, nullptr, &result.sourceSize);
+    result.elapsed = timer.elapsed();
+
+    return result;
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::createThumbnails一次创建多个尺寸的缩略图
+ * \~chinese \param info 文件信息
+ * \~chinese \param sizes 需要创建的缩略图大小
+ * \~chinese \return 与 sizes 一一对应的缩略图路径，创建失败的为空
+ * \~chinese \note 源文件只按其中最大的尺寸解码一次，其余尺寸由解码结果缩小得到
+ */
+QStringList DThumbnailProvider::createThumbnails(const QFileInfo &info, const QList<DThumbnailProvider::Size> &sizes)
+{
+    Q_D(DThumbnailProvider);
+
+    QString errorString;
+    const QStringList &thumbnails = d->createThumbnails(info, sizes, errorString);
+
+    d->setErrorString(errorString);
+
+    return thumbnails;
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::createThumbnail从设备中读取数据并创建缩略图
+ * \~chinese \param device 图片数据，未打开时以只读方式打开，可以是顺序设备（如压缩包中的文件流）
+ * \~chinese \param cacheKey 数据的稳定标识，建议使用 URI（如 "archive:///home/user/a.zip#photos/1.jpg"），
+ * \~chinese 作为缩略图规范中的 Thumb::URL，缩略图文件名为其 MD5 值
+ * \~chinese \param mtime 数据的修改时间，单位为秒，数据改变后需要使用新的修改时间
+ * \~chinese \param size 图片大小
+ * \~chinese \return 成功返回缩略图的绝对路径，失败则返回空，可通过 errorString 获取错误信息
+ * \~chinese \note 数据直接从设备中解码，无需先写入临时文件；缩略图的保存位置与格式和文件的缩略图相同，
+ * \~chinese 可通过 thumbnailFilePath(const QString &, qint64, Size) 查找。发出的信号中以 cacheKey 代替源文件路径
+ */
+QString DThumbnailProvider::createThumbnail(QIODevice *device, const QString &cacheKey, qint64 mtime, DThumbnailProvider::Size size)
+{
+    Q_D(DThumbnailProvider);
+
+    QString errorString;
+    const QString &thumbnail = d->createThumbnail(device, cacheKey, mtime, size, errorString);
+
+    d->setErrorString(errorString);
+
+    return thumbnail;
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::createThumbnail从内存中的数据创建缩略图
+ * \~chinese \param data 图片数据
+ * \~chinese \param cacheKey 数据的稳定标识
+ * \~chinese \param mtime 数据的修改时间，单位为秒
+ * \~chinese \param size 图片大小
+ * \~chinese \return 成功返回缩略图的绝对路径，失败则返回空
+ * \~chinese \sa createThumbnail(QIODevice *, const QString &, qint64, Size)
+ */
+QString DThumbnailProvider::createThumbnail(const QByteArray &data, const QString &cacheKey, qint64 mtime, DThumbnailProvider::Size size)
+{
+    QBuffer buffer;
+
+    buffer.setData(data);
+
+    return createThumbnail(&buffer, cacheKey, mtime, size);
+}
+
+void DThumbnailProvider::appendToProduceQueue(const QFileInfo &info, DThumbnailProvider::Size size, DThumbnailProvider::CallBack callback)
+{
+    appendToProduceQueue(info, size, 0, callback);
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::thumbnailImage返回文件的缩略图图片
+ * \~chinese \param info 文件信息
+ * \~chinese \param size 图片大小
+ * \~chinese \return 缩略图图片，失败时为空，可通过 errorString 获取错误信息
+ * \~chinese \note 缩略图不存在时会先生成。启用缩略图服务后由提供服务的进程生成，返回的图片直接映射其共享内存，
+ * \~chinese 同一会话中显示相同缩略图的多个应用共用同一份像素数据
+ * \~chinese \sa setThumbnailServiceEnabled
+ */
+QImage DThumbnailProvider::thumbnailImage(const QFileInfo &info, DThumbnailProvider::Size size)
+{
+    Q_D(DThumbnailProvider);
+
+    QString errorString;
+    QMutexLocker locker(&d->serviceMutex);
+    DThumbnailService *service = d->service;
+
+    locker.unlock();
+
+    if (service && service->isRunning())
+    {
+        bool unavailable = false;
+        const QImage &image = service->request(info.absoluteFilePath(), size, &errorString, &unavailable);
+
+        // 服务不可用或超时未回复时在当前进程中生成
+        if (!image.isNull() || (service->isRunning() && !unavailable))
+        {
+            d->setErrorString(errorString);
+
+            return image;
+        }
+
+        errorString.clear();
+    }
+
+    const QImage &image = d->loadThumbnailImage(info.absoluteFilePath(), size, &errorString);
+
+    d->setErrorString(errorString);
+
+    return image;
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::thumbnailImage返回适合在指定缩放比例的屏幕上显示的缩略图
+ * \~chinese \param info 文件信息
+ * \~chinese \param logicalSize 显示区域的逻辑大小
+ * \~chinese \param devicePixelRatio 屏幕的缩放比例
+ * \~chinese \return 宽高不超过 logicalSize * devicePixelRatio 且已设置 devicePixelRatio 的图片，失败时为空
+ * \~chinese \note 优先使用已缓存的不小于所需像素大小的缩略图并在内存中缩小，缩小已有的缩略图比解码源文件快得多；
+ * \~chinese 没有这样的缩略图时才生成 sizeForPixelSize 返回的尺寸
+ * \~chinese \sa sizeForPixelSize
+ */
+QImage DThumbnailProvider::thumbnailImage(const QFileInfo &info, int logicalSize, qreal devicePixelRatio)
+{
+    Q_D(DThumbnailProvider);
+
+    const qreal ratio = devicePixelRatio > 0 ? devicePixelRatio : 1;
+    const int pixelSize = qMax(1, qCeil(logicalSize * ratio));
+    const Size size = sizeForPixelSize(logicalSize, ratio);
+    const QList<Size> &sizes = thumbnailSizes();
+    QImage image;
+
+    for (int i = sizes.indexOf(size); i < sizes.size() && image.isNull(); ++i)
+    {
+        const QString &thumbnail = thumbnailFilePath(info, sizes.at(i));
+
+        if (!thumbnail.isEmpty())
+        {
+            image.load(thumbnail);
+        }
+    }
+
+    if (image.isNull())
+    {
+        image = thumbnailImage(info, size);
+    }
+    else
+    {
+        d->setErrorString(QString());
+    }
+
+    if (image.isNull())
+    {
+        return image;
+    }
+
+    if (image.width() > pixelSize || image.height() > pixelSize)
+    {
+        image = DImageScaler::scaled(image, QSize(pixelSize, pixelSize), Qt::KeepAspectRatio);
+    }
+
+    image.setDevicePixelRatio(ratio);
+
+    return image;
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::sizeForPixelSize返回显示指定大小的缩略图所需的尺寸
+ * \~chinese \param logicalSize 显示区域的逻辑大小
+ * \~chinese \param devicePixelRatio 屏幕的缩放比例
+ * \~chinese \return 不小于 logicalSize * devicePixelRatio 的最小尺寸，都小于时返回 XXLarge
+ */
+DThumbnailProvider::Size DThumbnailProvider::sizeForPixelSize(int logicalSize, qreal devicePixelRatio)
+{
+    const qreal pixelSize = logicalSize * (devicePixelRatio > 0 ? devicePixelRatio : 1);
+
+    for (Size size : thumbnailSizes())
+    {
+        if (size >= pixelSize)
+        {
+            return size;
+        }
+    }
+
+    return XXLarge;
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::appendToProduceQueue将文件加入缩略图生成队列
+ * \~chinese \param info 文件信息
+ * \~chinese \param size 缩略图大小
+ * \~chinese \param priority 优先级，值越大越先处理，默认为0
+ * \~chinese \param callback 生成结束后在工作线程中调用，参数为缩略图路径，失败时为空
+ * \~chinese \note 同一优先级内最后加入的任务最先处理，可将可见区域内的文件以较高优先级加入，
+ * \~chinese 使其不必等待已滚动出视野的文件
+ * \~chinese \sa setProducePriority
+ */
+void DThumbnailProvider::appendToProduceQueue(const QFileInfo &info, DThumbnailProvider::Size size, int priority, DThumbnailProvider::CallBack callback)
+{
+    appendToProduceQueue(info, size, priority, PreviewCallBack(), callback);
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::appendToProduceQueue将文件加入缩略图生成队列，并在生成前先提供预览
+ * \~chinese \param info 文件信息
+ * \~chinese \param size 图片大小
+ * \~chinese \param priority 优先级
+ * \~chinese \param previewCallback 预览可用时调用，参数为预览图片
+ * \~chinese \param callback 生成结束后调用，参数为缩略图路径
+ * \~chinese \note 预览来自已缓存的其它尺寸、JPEG 内嵌的 EXIF 缩略图或按1/8大小解码的 JPEG，都不可用或缩略图已存在时
+ * \~chinese 不调用 previewCallback。预览只在内存中，缓存目录中保存的仍是完整质量的缩略图
+ * \~chinese \sa setProgressiveThumbnailEnabled
+ */
+void DThumbnailProvider::appendToProduceQueue(const QFileInfo &info, DThumbnailProvider::Size size, int priority,
+                                              DThumbnailProvider::PreviewCallBack previewCallback, DThumbnailProvider::CallBack callback)
+{
+    DThumbnailProviderPrivate::ProduceInfo produceInfo;
+
+    produceInfo.fileInfo = info;
+    produceInfo.size = size;
+    produceInfo.priority = priority;
+
+    // 没有回调的调用同样记为一个请求，removeInProduceQueue 按请求移除
+    DThumbnailProviderPrivate::ProduceRequest request;
+
+    request.callback = callback;
+    request.previewCallback = previewCallback;
+    produceInfo.requests.append(request);
+
+    Q_D(DThumbnailProvider);
+
+    // 新的请求使之前的移除失效
+    const DThumbnailProviderPrivate::ProduceKey &key = qMakePair(info.absoluteFilePath(), size);
+
+    if (isRunning())
+    {
+        QWriteLocker locker(&d->dataReadWriteLock);
+        d->discardedProduceInfos.remove(key);
+        d->enqueue(std::move(produceInfo));
+        d->startWorkers();
+        locker.unlock();
+        d->waitCondition.wakeAll();
+    }
+    else
+    {
+        QWriteLocker locker(&d->dataReadWriteLock);
+        d->discardedProduceInfos.remove(key);
+        d->enqueue(std::move(produceInfo));
+        d->startWorkers();
+        locker.unlock();
+        start();
+    }
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::setProducePriority修改队列中尚未处理的任务的优先级
+ * \~chinese \param info 文件信息
+ * \~chinese \param size 缩略图大小
+ * \~chinese \param priority 新的优先级
+ * \~chinese \return 队列中存在对应任务时返回 true
+ * \~chinese \note 被修改的任务视为最新加入的任务，在新优先级内最先处理
+ */
+bool DThumbnailProvider::setProducePriority(const QFileInfo &info, DThumbnailProvider::Size size, int priority)
+{
+    Q_D(DThumbnailProvider);
+
+    QWriteLocker locker(&d->dataReadWriteLock);
+    Q_UNUSED(locker)
+
+    const DThumbnailProviderPrivate::ProduceKey &key = qMakePair(info.absoluteFilePath(), size);
+
+    if (!d->produceOrders.contains(key))
+    {
+        return false;
+    }
+
+    DThumbnailProviderPrivate::ProduceInfo produceInfo = d->produceQueue.take(d->produceOrders.take(key));
+    produceInfo.priority = priority;
+    d->enqueue(std::move(produceInfo));
+
+    return true;
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::mergedProduceCount返回被合并的重复请求数量
+ * \~chinese \return 加入生成队列时与队列中相同文件、相同大小的任务合并的请求总数
+ * \~chinese \note 合并后的任务只生成一次缩略图，结束后依次调用所有请求的回调。相同任务正在生成时，
+ * \~chinese 新的请求等其结束后一并重新生成，缩略图仍有效时不再解码
+ */
+qint64 DThumbnailProvider::mergedProduceCount() const
+{
+    Q_D(const DThumbnailProvider);
+
+    QReadLocker locker(&d->dataReadWriteLock);
+    Q_UNUSED(locker)
+
+    return d->mergedProduceCount;
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::removeInProduceQueue将缩略图从列表中删除
+ * \~chinese \param info缩略图文件
+ * \~chinese \param size缩略图大小
+ * \~chinese \note 每次调用移除最近一次 appendToProduceQueue 加入的请求，不再调用其回调；
+ * \~chinese 合并在同一任务中的其它请求仍会得到结果，全部请求都被移除后才取消任务
+ */
+void DThumbnailProvider::removeInProduceQueue(const QFileInfo &info, DThumbnailProvider::Size size)
+{
+    Q_D(DThumbnailProvider);
+
+    QWriteLocker locker(&d->dataReadWriteLock);
+    Q_UNUSED(locker)
+
+    d->discard(qMakePair(info.absoluteFilePath(), size));
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::maxThreadCount返回同时生成缩略图的最大线程数
+ * \~chinese \return 最大线程数，默认为 QThread::idealThreadCount()
+ */
+int DThumbnailProvider::maxThreadCount() const
+{
+    Q_D(const DThumbnailProvider);
+
+    QReadLocker locker(&d->dataReadWriteLock);
+    Q_UNUSED(locker)
+
+    return d->maxThreadCount;
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::setMaxThreadCount设置同时生成缩略图的最大线程数
+ * \~chinese \param count 线程数，小于1时按1处理
+ * \~chinese \note 生成队列中的任务由这些线程并行处理，多余的空闲线程会自动退出
+ */
+void DThumbnailProvider::setMaxThreadCount(int count)
+{
+    Q_D(DThumbnailProvider);
+
+    QWriteLocker locker(&d->dataReadWriteLock);
+
+    d->maxThreadCount = qMax(1, count);
+
+    if (isRunning())
+    {
+        d->startWorkers();
+    }
+
+    locker.unlock();
+    d->waitCondition.wakeAll();
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::progressiveThumbnailEnabled是否为生成队列中的所有任务先提供预览
+ * \~chinese \return 提供时返回 true，默认不提供
+ */
+bool DThumbnailProvider::progressiveThumbnailEnabled() const
+{
+    Q_D(const DThumbnailProvider);
+
+    QReadLocker locker(&d->dataReadWriteLock);
+    Q_UNUSED(locker)
+
+    return d->progressiveEnabled;
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::setProgressiveThumbnailEnabled设置是否为生成队列中的所有任务先提供预览
+ * \~chinese \param enabled 是否提供
+ * \~chinese \note 启用后工作线程在生成缩略图前先尝试得到一张代价很小的预览并发送 thumbnailPreviewReady 信号，
+ * \~chinese 之后照常生成完整质量的缩略图。源文件很大时界面可以先显示预览，不必等待完整的解码
+ */
+void DThumbnailProvider::setProgressiveThumbnailEnabled(bool enabled)
+{
+    Q_D(DThumbnailProvider);
+
+    QWriteLocker locker(&d->dataReadWriteLock);
+    Q_UNUSED(locker)
+
+    d->progressiveEnabled = enabled;
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::readaheadCount返回生成队列中预读的源文件数量
+ * \~chinese \return 数量，0表示不预读
+ */
+int DThumbnailProvider::readaheadCount() const
+{
+    Q_D(const DThumbnailProvider);
+
+    QReadLocker locker(&d->dataReadWriteLock);
+    Q_UNUSED(locker)
+
+    return d->readaheadCount;
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::setReadaheadCount设置生成队列中预读的源文件数量
+ * \~chinese \param count 数量，0表示不预读，默认为4
+ * \~chinese \note 工作线程取出任务时通知内核在后台读取队列中接下来的源文件，源文件位于机械硬盘或网络文件系统中时，
+ * \~chinese 读取文件的等待时间与解码的时间重叠，可以明显提高生成缩略图的速度
+ */
+void DThumbnailProvider::setReadaheadCount(int count)
+{
+    Q_D(DThumbnailProvider);
+
+    QWriteLocker locker(&d->dataReadWriteLock);
+    Q_UNUSED(locker)
+
+    d->readaheadCount = qMax(0, count);
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::thumbnailIndexEnabled是否使用缩略图索引文件
+ * \~chinese \return 使用时返回 true，默认不使用
+ */
+bool DThumbnailProvider::thumbnailIndexEnabled() const
+{
+    Q_D(const DThumbnailProvider);
+
+    QMutexLocker locker(&d->indexMutex);
+    Q_UNUSED(locker)
+
+    return d->indexEnabled;
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::setThumbnailIndexEnabled设置是否使用缩略图索引文件
+ * \~chinese \param enabled 是否使用
+ * \~chinese \note 每个缩略图目录下会有一个通过内存映射在多个进程间共享的索引文件，记录缩略图对应的
+ * \~chinese 源文件修改时间及是否生成失败，查询缩略图时可不再访问文件系统。索引由 createThumbnail
+ * \~chinese 维护，也可通过 rebuildThumbnailIndex 从缩略图目录重建
+ */
+void DThumbnailProvider::setThumbnailIndexEnabled(bool enabled)
+{
+    Q_D(DThumbnailProvider);
+
+    QMutexLocker locker(&d->indexMutex);
+    Q_UNUSED(locker)
+
+    d->indexEnabled = enabled;
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::rebuildThumbnailIndex根据缩略图目录中的文件重建索引
+ * \~chinese \return 全部目录的索引重建成功时返回 true
+ * \~chinese \note 只读取缩略图中的文本信息，不会解码图片
+ */
+bool DThumbnailProvider::rebuildThumbnailIndex()
+{
+    Q_D(DThumbnailProvider);
+
+    QStringList directories {THUMBNAIL_FAIL_PATH};
+
+    for (Size size : thumbnailSizes())
+    {
+        directories.append(d->sizeToFilePath(size));
+    }
+
+    const QStringList keys {
+        QT_STRINGIFY(Thumb::URL),
+        QT_STRINGIFY(Thumb::MTime),
+        QT_STRINGIFY(Thumb::Size)
+    };
+    bool ok = true;
+
+    for (const QString &directory : directories)
+    {
+        DThumbnailIndex *index = d->thumbnailIndex(directory);
+
+        if (!index)
+        {
+            return false;
+        }
+
+        const DThumbnailIndex::State state = directory == THUMBNAIL_FAIL_PATH ? DThumbnailIndex::Failed : DThumbnailIndex::Valid;
+        QList<DThumbnailIndex::Entry> entries;
+        QDirIterator iterator(directory, {QStringLiteral("*" FORMAT)}, QDir::Files);
+
+        while (iterator.hasNext())
+        {
+            const QString &fileName = iterator.next();
+            QHash<QString, QString> texts;
+
+            if (!readPngText(fileName, keys, &texts) || !texts.contains(QT_STRINGIFY(Thumb::MTime)))
+            {
+                continue;
+            }
+
+            DThumbnailIndex::Entry entry;
+
+            entry.hash = QCryptographicHash::hash(texts.value(QT_STRINGIFY(Thumb::URL)).toLocal8Bit(), QCryptographicHash::Md5);
+
+            // 文件名与 URL 不对应的不是有效的缩略图
+            if (iterator.fileInfo().completeBaseName().toLatin1() != entry.hash.toHex())
+            {
+                continue;
+            }
+
+            entry.state = state;
+            entry.mtime = texts.value(QT_STRINGIFY(Thumb::MTime)).toLongLong();
+            entry.size = texts.value(QT_STRINGIFY(Thumb::Size)).toLongLong();
+            entries.append(entry);
+        }
+
+        ok = index->reset(entries) && ok;
+    }
+
+    return ok;
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::batchDeliveryTarget返回接收生成队列结果的对象
+ * \~chinese \return 接收对象，未设置时为空
+ */
+QObject *DThumbnailProvider::batchDeliveryTarget() const
+{
+    Q_D(const DThumbnailProvider);
+
+    QMutexLocker locker(&d->deliveryMutex);
+    Q_UNUSED(locker)
+
+    return d->deliveryTarget.data();
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::setBatchDeliveryTarget设置接收生成队列结果的对象
+ * \~chinese \param target 接收对象，为空时恢复默认行为
+ * \~chinese \note 默认情况下生成队列中每个任务结束后都会在工作线程中调用回调并发出信号。设置接收对象后，
+ * \~chinese 结果会先收集起来，在 target 所在线程的下一次事件循环中一并处理：依次发出 createThumbnailFinished、
+ * \~chinese thumbnailChanged 或 createThumbnailFailed 信号并调用回调，最后发出一次 createThumbnailsBatchFinished
+ * \~chinese 信号，界面只需在收到此信号时更新一次
+ */
+void DThumbnailProvider::setBatchDeliveryTarget(QObject *target)
+{
+    Q_D(DThumbnailProvider);
+
+    QMutexLocker locker(&d->deliveryMutex);
+
+    // 接收对象被销毁时 deliveryTarget 已被置空，仍需处理未完成的结果
+    if (target && d->deliveryTarget == target)
+    {
+        return;
+    }
+
+    if (d->deliveryTarget)
+    {
+        disconnect(d->deliveryTarget.data(), &QObject::destroyed, this, nullptr);
+    }
+
+    d->deliveryTarget = target;
+    // 之前投递给旧对象的处理请求可能不会再执行，需要重新投递
+    d->deliveryScheduled = !d->pendingResults.isEmpty() && target;
+
+    if (target)
+    {
+        connect(target, &QObject::destroyed, this, [this] {
+            setBatchDeliveryTarget(nullptr);
+        }, Qt::DirectConnection);
+
+        if (d->deliveryScheduled)
+        {
+            QMetaObject::invokeMethod(target, [d] {
+                d->deliverPendingResults();
+            }, Qt::QueuedConnection);
+        }
+
+        return;
+    }
+
+    locker.unlock();
+    d->deliverPendingResults();
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::cacheSizeLimit返回缩略图目录占用空间的上限
+ * \~chinese \param size 缩略图大小
+ * \~chinese \return 上限，单位为字节，0表示不限制
+ */
+qint64 DThumbnailProvider::cacheSizeLimit(DThumbnailProvider::Size size) const
+{
+    Q_D(const DThumbnailProvider);
+
+    QMutexLocker locker(&d->cacheMutex);
+    Q_UNUSED(locker)
+
+    return d->cacheLimits.value(size).bytes;
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::setCacheSizeLimit设置缩略图目录占用空间的上限
+ * \~chinese \param size 缩略图大小
+ * \~chinese \param bytes 上限，单位为字节，0表示不限制
+ * \~chinese \sa collectGarbage
+ */
+void DThumbnailProvider::setCacheSizeLimit(DThumbnailProvider::Size size, qint64 bytes)
+{
+    Q_D(DThumbnailProvider);
+
+    QMutexLocker locker(&d->cacheMutex);
+    Q_UNUSED(locker)
+
+    d->cacheLimits[size].bytes = qMax<qint64>(0, bytes);
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::cacheEntryLimit返回缩略图目录中文件数量的上限
+ * \~chinese \param size 缩略图大小
+ * \~chinese \return 上限，0表示不限制
+ */
+int DThumbnailProvider::cacheEntryLimit(DThumbnailProvider::Size size) const
+{
+    Q_D(const DThumbnailProvider);
+
+    QMutexLocker locker(&d->cacheMutex);
+    Q_UNUSED(locker)
+
+    return d->cacheLimits.value(size).entries;
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::setCacheEntryLimit设置缩略图目录中文件数量的上限
+ * \~chinese \param size 缩略图大小
+ * \~chinese \param count 上限，0表示不限制
+ * \~chinese \sa collectGarbage
+ */
+void DThumbnailProvider::setCacheEntryLimit(DThumbnailProvider::Size size, int count)
+{
+    Q_D(DThumbnailProvider);
+
+    QMutexLocker locker(&d->cacheMutex);
+    Q_UNUSED(locker)
+
+    d->cacheLimits[size].entries = qMax(0, count);
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::collectGarbage在后台清理缩略图目录
+ * \~chinese \return 开始清理时返回 true，上一次清理尚未结束时返回 false
+ * \~chinese \note 删除源文件已不存在的缩略图及失败记录；某个大小的缩略图超出 setCacheSizeLimit 或
+ * \~chinese setCacheEntryLimit 设置的上限时，按最近访问时间从旧到新删除。清理在空闲优先级的线程中进行，
+ * \~chinese 结束后发出 garbageCollectionFinished 信号
+ */
+bool DThumbnailProvider::collectGarbage()
+{
+    Q_D(DThumbnailProvider);
+
+    QMutexLocker locker(&d->cacheMutex);
+    Q_UNUSED(locker)
+
+    if (!d->garbageCollector)
+    {
+        d->garbageCollector = new DThumbnailGarbageCollector(d);
+    }
+
+    if (d->garbageCollector->isRunning())
+    {
+        return false;
+    }
+
+    d->garbageCollector->start(QThread::IdlePriority);
+
+    return true;
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::extensionOnlyMimeDirectories返回只按扩展名检测文件类型的目录
+ * \~chinese \return 目录列表
+ */
+QStringList DThumbnailProvider::extensionOnlyMimeDirectories() const
+{
+    Q_D(const DThumbnailProvider);
+
+    QReadLocker locker(&d->mimeDirectoriesLock);
+    Q_UNUSED(locker)
+
+    return d->extensionOnlyMimeDirectories;
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::setExtensionOnlyMimeDirectories设置只按扩展名检测文件类型的目录
+ * \~chinese \param directories 目录列表，包括其子目录
+ * \~chinese \note 默认按文件内容检测类型，需要打开并读取文件。对于扩展名可信的目录（如应用自己管理的图库），
+ * \~chinese 只按扩展名检测可以避免这些读取；扩展名未知的文件仍按内容检测
+ */
+void DThumbnailProvider::setExtensionOnlyMimeDirectories(const QStringList &directories)
+{
+    Q_D(DThumbnailProvider);
+
+    QWriteLocker locker(&d->mimeDirectoriesLock);
+    Q_UNUSED(locker)
+
+    d->extensionOnlyMimeDirectories.clear();
+
+    for (const QString &directory : directories)
+    {
+        d->extensionOnlyMimeDirectories.append(QDir::cleanPath(QFileInfo(directory).absoluteFilePath()));
+    }
+
+    d->clearKnownFailures();
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::watchDirectory监视目录中文件的变化
+ * \~chinese \param path 目录路径，一般为应用中当前打开的目录
+ * \~chinese \return 成功时返回 true
+ * \~chinese \note 目录中的文件被修改后立即删除其过期的缩略图，发出 thumbnailChanged 信号（缩略图路径为空），
+ * \~chinese 并将其重新加入生成队列；文件被删除时只删除缩略图。界面查询缩略图时不必再等待校验。
+ * \~chinese 监视通过 inotify 实现，文件变化在首次调用此函数的线程的事件循环中处理
  */
-QString DThumbnailProvider::thumbnailFilePath(const QFileInfo &info, Size size) const
+bool DThumbnailProvider::watchDirectory(const QString &path)
 {
-    Q_D(const DThumbnailProvider);
+#ifdef Q_OS_LINUX
+    Q_D(DThumbnailProvider);
 
-    const QString &absolutePath = info.absolutePath();
-    const QString &absoluteFilePath = info.absoluteFilePath();
+    const QString &directory = QFileInfo(path).absoluteFilePath();
+    QMutexLocker locker(&d->watchMutex);
+    Q_UNUSED(locker)
 
-    if (absolutePath == d->sizeToFilePath(Small)
-            || absolutePath == d->sizeToFilePath(Normal)
-            || absolutePath == d->sizeToFilePath(Large)
-            || absolutePath == THUMBNAIL_FAIL_PATH)
+    if (d->inotifyFd < 0)
     {
-        return absoluteFilePath;
-    }
+        d->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
 
-    const QString thumbnailName = dataToMd5Hex(QUrl::fromLocalFile(absoluteFilePath).toString(QUrl::FullyEncoded).toLocal8Bit()) + FORMAT;
-    QString thumbnail = d->sizeToFilePath(size) + QDir::separator() + thumbnailName;
+        if (d->inotifyFd < 0)
+        {
+            return false;
+        }
 
-    if (!QFile::exists(thumbnail))
-    {
-        return QString();
+        d->inotifyNotifier = new QSocketNotifier(d->inotifyFd, QSocketNotifier::Read);
+        connect(d->inotifyNotifier, &QSocketNotifier::activated, this, [d] {
+            d->readWatchEvents();
+        });
     }
 
-    QImage image(thumbnail);
+    const int wd = inotify_add_watch(d->inotifyFd, QFile::encodeName(directory).constData(),
+                                     IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ONLYDIR);
 
-    if (image.text(QT_STRINGIFY(Thumb::MTime)).toInt() != (int)info.lastModified().toTime_t())
+    if (wd < 0)
     {
-        QFile::remove(thumbnail);
+        return false;
+    }
 
-        Q_EMIT thumbnailChanged(absoluteFilePath, QString());
+    d->watchedDirectories.insert(wd, directory);
 
-        return QString();
-    }
+    return true;
+#else
+    Q_UNUSED(path)
 
-    return thumbnail;
+    return false;
+#endif
 }
 
 /*!
- * \~chinese \brief DThumbnailProvider::createThumbnail创建缩略图
- * \~chinese \param info 文件信息
- * \~chinese \param size 图片大小
- * \~chinese \return 成功返回绝对路径信息，失败则返回空
+ * \~chinese \brief DThumbnailProvider::unwatchDirectory停止监视目录
+ * \~chinese \param path 目录路径
  */
-QString DThumbnailProvider::createThumbnail(const QFileInfo &info, DThumbnailProvider::Size size)
+void DThumbnailProvider::unwatchDirectory(const QString &path)
 {
+#ifdef Q_OS_LINUX
     Q_D(DThumbnailProvider);
 
-    d->errorString.clear();
+    QMutexLocker locker(&d->watchMutex);
+    Q_UNUSED(locker)
 
-    const QString &absolutePath = info.absolutePath();
-    const QString &absoluteFilePath = info.absoluteFilePath();
+    const int wd = d->watchedDirectories.key(QFileInfo(path).absoluteFilePath(), -1);
 
-    if (absolutePath == d->sizeToFilePath(Small)
-            || absolutePath == d->sizeToFilePath(Normal)
-            || absolutePath == d->sizeToFilePath(Large)
-            || absolutePath == THUMBNAIL_FAIL_PATH)
+    if (wd >= 0)
     {
-        return absoluteFilePath;
+        inotify_rm_watch(d->inotifyFd, wd);
+        d->watchedDirectories.remove(wd);
     }
+#else
+    Q_UNUSED(path)
+#endif
+}
 
-    if (!hasThumbnail(info))
-    {
-        d->errorString = QStringLiteral("This file has not support thumbnail: ") + absoluteFilePath;
-
-        //!Warnning: Do not store thumbnails to the fail path
-        return QString();
-    }
+/*!
+ * \~chinese \brief DThumbnailProvider::watchedDirectories返回正在监视的目录
+ * \~chinese \return 目录列表
+ */
+QStringList DThumbnailProvider::watchedDirectories() const
+{
+    Q_D(const DThumbnailProvider);
 
-    const QString fileUrl = QUrl::fromLocalFile(absoluteFilePath).toString(QUrl::FullyEncoded);
-    const QString thumbnailName = dataToMd5Hex(fileUrl.toLocal8Bit()) + FORMAT;
+    QMutexLocker locker(&d->watchMutex);
+    Q_UNUSED(locker)
 
-    // the file is in fail path
-    QString thumbnail = THUMBNAIL_FAIL_PATH + QDir::separator() + thumbnailName;
+    return d->watchedDirectories.values();
+}
 
-    if (QFile::exists(thumbnail))
-    {
-        QImage image(thumbnail);
+/*!
+ * \~chinese \brief DThumbnailProvider::thumbnailServiceEnabled是否使用会话内共享的缩略图服务
+ * \~chinese \return 使用时返回 true，默认不使用
+ */
+bool DThumbnailProvider::thumbnailServiceEnabled() const
+{
+    Q_D(const DThumbnailProvider);
 
-        if (image.text(QT_STRINGIFY(Thumb::MTime)).toInt() != (int)info.lastModified().toTime_t())
-        {
-            QFile::remove(thumbnail);
-        }
-        else
-        {
-            return QString();
-        }
-    }// end
+    QMutexLocker locker(&d->serviceMutex);
+    Q_UNUSED(locker)
 
-    QScopedPointer<QImage> image(new QImage(QSize(size, size), QImage::Format_ARGB32_Premultiplied));
-    QImageReader reader(absoluteFilePath);
+    return d->service && d->service->isRunning();
+}
 
-    if (!reader.canRead())
-    {
-        reader.setFormat(d->mimeDatabase.mimeTypeForFile(info).name().toLocal8Bit());
+/*!
+ * \~chinese \brief DThumbnailProvider::setThumbnailServiceEnabled设置是否使用会话内共享的缩略图服务
+ * \~chinese \param enabled 是否使用
+ * \~chinese \note 启用后连接到当前会话中的缩略图服务，服务不存在时由当前进程提供服务，不依赖额外的守护进程。
+ * \~chinese thumbnailImage 的请求通过 XDG_RUNTIME_DIR 中的本地套接字发送给提供服务的进程，结果以密封的 memfd
+ * \~chinese 返回，图片只在一个进程中解码，各进程映射同一份内存。提供服务的进程退出后其它进程会自动接替
+ */
+void DThumbnailProvider::setThumbnailServiceEnabled(bool enabled)
+{
+    Q_D(DThumbnailProvider);
 
-        if (!reader.canRead())
-        {
-            d->errorString = reader.errorString();
-        }
-    }
+    QMutexLocker locker(&d->serviceMutex);
 
-    if (d->errorString.isEmpty())
+    if (!enabled)
     {
-        const QSize &imageSize = reader.size();
+        DThumbnailService *service = d->service;
 
-        if (imageSize.isValid())
-        {
-            if (imageSize.width() >= size || imageSize.height() >= size)
-            {
-                reader.setScaledSize(reader.size().scaled(size, size, Qt::KeepAspectRatio));
-            }
+        d->service = nullptr;
+        locker.unlock();
+        delete service;
 
-            if (!reader.read(image.data()))
-            {
-                d->errorString = reader.errorString();
-            }
-        }
-        else
-        {
-            d->errorString = "Fail to read image file attribute data:" + info.absoluteFilePath();
-        }
+        return;
     }
 
-    // successful
-    if (d->errorString.isEmpty())
-    {
-        thumbnail = d->sizeToFilePath(size) + QDir::separator() + thumbnailName;
-    }
-    else
+    if (!d->service)
     {
-        //fail
-        image.reset(new QImage(1, 1, QImage::Format_Mono));
+        d->service = new DThumbnailService([d] (const QString &filePath, int size, QString *errorString) {
+            return d->loadThumbnailImage(filePath, size, errorString);
+        });
     }
 
-    image->setText(QT_STRINGIFY(Thumb::URL), fileUrl);
-    image->setText(QT_STRINGIFY(Thumb::MTime), QString::number(info.lastModified().toTime_t()));
+    d->service->start();
+}
 
-    // create path
-    QFileInfo(thumbnail).absoluteDir().mkpath(".");
+/*!
+ * \~chinese \brief DThumbnailProvider::isThumbnailServiceProvider当前进程是否在提供缩略图服务
+ * \~chinese \return 提供服务时返回 true
+ */
+bool DThumbnailProvider::isThumbnailServiceProvider() const
+{
+    Q_D(const DThumbnailProvider);
 
-    if (!image->save(thumbnail, Q_NULLPTR, 80))
-    {
-        d->errorString = QStringLiteral("Can not save image to ") + thumbnail;
-    }
+    QMutexLocker locker(&d->serviceMutex);
+    Q_UNUSED(locker)
 
-    if (d->errorString.isEmpty())
-    {
-        Q_EMIT createThumbnailFinished(absoluteFilePath, thumbnail);
-        Q_EMIT thumbnailChanged(absoluteFilePath, thumbnail);
+    return d->service && d->service->isServer();
+}
 
-        return thumbnail;
-    }
+/*!
+ * \~chinese \brief DThumbnailProvider::externalThumbnailerEnabled是否使用外部缩略图程序
+ * \~chinese \return 使用时返回 true，默认不使用
+ */
+bool DThumbnailProvider::externalThumbnailerEnabled() const
+{
+    Q_D(const DThumbnailProvider);
 
-    // fail
-    Q_EMIT createThumbnailFailed(absoluteFilePath);
+    return d->externalThumbnailer.isEnabled();
+}
 
-    return QString();
+/*!
+ * \~chinese \brief DThumbnailProvider::setExternalThumbnailerEnabled设置是否使用外部缩略图程序
+ * \~chinese \param enabled 是否使用
+ * \~chinese \note 启用后 Qt 无法读取的文件（如视频、PDF）交给 thumbnailers 数据目录中 .thumbnailer 文件
+ * \~chinese 注册的程序生成缩略图。每个任务运行在单独的子进程中，并限制其内存与运行时间，程序崩溃或超时
+ * \~chinese 只会使该文件生成失败。子进程只继承 PATH、HOME、LANG、LC_ALL、XDG_RUNTIME_DIR、DISPLAY、
+ * \~chinese XAUTHORITY 与 WAYLAND_DISPLAY 环境变量
+ */
+void DThumbnailProvider::setExternalThumbnailerEnabled(bool enabled)
+{
+    Q_D(DThumbnailProvider);
+
+    d->externalThumbnailer.setEnabled(enabled);
+    d->clearKnownFailures();
 }
 
-void DThumbnailProvider::appendToProduceQueue(const QFileInfo &info, DThumbnailProvider::Size size, DThumbnailProvider::CallBack callback)
+/*!
+ * \~chinese \brief DThumbnailProvider::externalThumbnailerTimeout返回外部缩略图程序的超时时间
+ * \~chinese \return 超时时间，单位为毫秒
+ */
+int DThumbnailProvider::externalThumbnailerTimeout() const
 {
-    DThumbnailProviderPrivate::ProduceInfo produceInfo;
+    Q_D(const DThumbnailProvider);
 
-    produceInfo.fileInfo = info;
-    produceInfo.size = size;
-    produceInfo.callback = callback;
+    return d->externalThumbnailer.timeout();
+}
 
+/*!
+ * \~chinese \brief DThumbnailProvider::setExternalThumbnailerTimeout设置外部缩略图程序的超时时间
+ * \~chinese \param msec 超时时间，单位为毫秒，超时后子进程会被结束
+ */
+void DThumbnailProvider::setExternalThumbnailerTimeout(int msec)
+{
     Q_D(DThumbnailProvider);
 
-    if (isRunning())
-    {
-        QWriteLocker locker(&d->dataReadWriteLock);
-        d->produceQueue.append(std::move(produceInfo));
-        locker.unlock();
-        d->waitCondition.wakeAll();
-    }
-    else
-    {
-        d->produceQueue.append(std::move(produceInfo));
-        start();
-    }
+    d->externalThumbnailer.setTimeout(msec);
 }
 
 /*!
- * \~chinese \brief DThumbnailProvider::removeInProduceQueue将缩略图从列表中删除
- * \~chinese \param info缩略图文件
- * \~chinese \param size缩略图大小
+ * \~chinese \brief DThumbnailProvider::externalThumbnailerConcurrency返回同一类型文件同时运行的外部程序数量上限
+ * \~chinese \param mimeType 文件类型
+ * \~chinese \return 数量上限，默认为2
  */
-void DThumbnailProvider::removeInProduceQueue(const QFileInfo &info, DThumbnailProvider::Size size)
+int DThumbnailProvider::externalThumbnailerConcurrency(const QMimeType &mimeType) const
 {
-    Q_D(DThumbnailProvider);
+    Q_D(const DThumbnailProvider);
 
-    if (isRunning())
-    {
-        QWriteLocker locker(&d->dataReadWriteLock);
-        Q_UNUSED(locker)
-    }
+    return d->externalThumbnailer.concurrency(mimeType.name());
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::setExternalThumbnailerConcurrency设置同一类型文件同时运行的外部程序数量上限
+ * \~chinese \param mimeType 文件类型
+ * \~chinese \param count 数量上限，小于1时按1处理
+ */
+void DThumbnailProvider::setExternalThumbnailerConcurrency(const QMimeType &mimeType, int count)
+{
+    Q_D(DThumbnailProvider);
 
-    d->discardedProduceInfos.insert(qMakePair(info.absoluteFilePath(), size));
+    d->externalThumbnailer.setConcurrency(mimeType.name(), count);
 }
 
 /*!
@@ -393,6 +3437,9 @@ QString DThumbnailProvider::errorString() const
 {
     Q_D(const DThumbnailProvider);
 
+    QMutexLocker locker(&d->errorStringMutex);
+    Q_UNUSED(locker)
+
     return d->errorString;
 }
 
@@ -404,6 +3451,9 @@ qint64 DThumbnailProvider::defaultSizeLimit() const
 {
     Q_D(const DThumbnailProvider);
 
+    QReadLocker locker(&d->sizeLimitLock);
+    Q_UNUSED(locker)
+
     return d->defaultSizeLimit;
 }
 
@@ -415,7 +3465,78 @@ void DThumbnailProvider::setDefaultSizeLimit(qint64 size)
 {
     Q_D(DThumbnailProvider);
 
+    QWriteLocker locker(&d->sizeLimitLock);
+    Q_UNUSED(locker)
+
     d->defaultSizeLimit = size;
+    d->clearKnownFailures();
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::negativeCacheTimeout返回内存中失败记录的有效时间
+ * \~chinese \return 有效时间，单位为毫秒，0表示不记录
+ */
+int DThumbnailProvider::negativeCacheTimeout() const
+{
+    Q_D(const DThumbnailProvider);
+
+    QMutexLocker locker(&d->knownFailuresMutex);
+    Q_UNUSED(locker)
+
+    return d->knownFailureTimeout;
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::setNegativeCacheTimeout设置内存中失败记录的有效时间
+ * \~chinese \param msec 有效时间，单位为毫秒，0表示不记录，默认为5分钟
+ * \~chinese \note 不支持的文件以及生成失败的文件以路径、修改时间和大小为键记录在内存中，有效时间内再次请求时
+ * \~chinese 无需检测 MIME 类型或读取失败记录文件。文件被修改后记录自动失效，记录的数量也有上限
+ */
+void DThumbnailProvider::setNegativeCacheTimeout(int msec)
+{
+    Q_D(DThumbnailProvider);
+
+    QMutexLocker locker(&d->knownFailuresMutex);
+    Q_UNUSED(locker)
+
+    d->knownFailureTimeout = qMax(0, msec);
+
+    if (d->knownFailureTimeout == 0)
+    {
+        d->knownFailures.clear();
+    }
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::decodeMemoryLimit返回生成一个缩略图时解码图片可使用的内存上限
+ * \~chinese \return 上限，单位为字节，0表示不限制
+ */
+qint64 DThumbnailProvider::decodeMemoryLimit() const
+{
+    Q_D(const DThumbnailProvider);
+
+    QReadLocker locker(&d->sizeLimitLock);
+    Q_UNUSED(locker)
+
+    return d->decodeMemoryLimit;
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::setDecodeMemoryLimit设置生成一个缩略图时解码图片可使用的内存上限
+ * \~chinese \param bytes 上限，单位为字节，0表示不限制，默认为256MB
+ * \~chinese \note 与按文件大小限制的 setSizeLimit 不同，此上限针对解码后的像素数据。支持按缩小后的大小
+ * \~chinese 解码的格式（如 JPEG、PNG、SVG）按缩小后的大小计算；其它格式需要解码整张图片，超出上限时
+ * \~chinese 不再解码，直接记录为生成失败
+ */
+void DThumbnailProvider::setDecodeMemoryLimit(qint64 bytes)
+{
+    Q_D(DThumbnailProvider);
+
+    QWriteLocker locker(&d->sizeLimitLock);
+    Q_UNUSED(locker)
+
+    d->decodeMemoryLimit = qMax<qint64>(0, bytes);
+    d->clearKnownFailures();
 }
 
 /*!
@@ -427,6 +3548,9 @@ qint64 DThumbnailProvider::sizeLimit(const QMimeType &mimeType) const
 {
     Q_D(const DThumbnailProvider);
 
+    QReadLocker locker(&d->sizeLimitLock);
+    Q_UNUSED(locker)
+
     return d->sizeLimitHash.value(mimeType, d->defaultSizeLimit);
 }
 
@@ -439,7 +3563,87 @@ void DThumbnailProvider::setSizeLimit(const QMimeType &mimeType, qint64 size)
 {
     Q_D(DThumbnailProvider);
 
+    QWriteLocker locker(&d->sizeLimitLock);
+    Q_UNUSED(locker)
+
     d->sizeLimitHash[mimeType] = size;
+    d->clearKnownFailures();
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::statistics返回缩略图生成的统计数据
+ * \~chinese \return 统计数据，包含以下内容：
+ * \~chinese \li queueDepth、inFlight：生成队列中等待的任务数及正在生成的任务数
+ * \~chinese \li cacheHits、cacheMisses、cacheStale：查找缩略图时命中、不存在及已过期的次数
+ * \~chinese \li thumbnailsCreated、thumbnailsFailed、bytesWritten：生成的缩略图数量、生成失败的文件数量及写入的字节数
+ * \~chinese \li decodeLatency：以 MIME 类型为键的解码耗时，writeLatency：写入缩略图的耗时。每项包含次数 count、
+ * \~chinese 总耗时 totalMsecs 以及直方图 buckets，其中第 i 项为耗时小于 2^i 微秒（且不小于 2^(i-1) 微秒）的次数
+ * \~chinese \note 统计数据由工作线程以原子操作记录，不会加锁，只有调用此函数时才汇总
+ * \~chinese \sa resetStatistics setStatisticsInterval
+ */
+QVariantMap DThumbnailProvider::statistics() const
+{
+    Q_D(const DThumbnailProvider);
+
+    QVariantMap map = d->statistics.toVariantMap();
+    QReadLocker locker(&d->dataReadWriteLock);
+
+    map.insert("queueDepth", d->produceQueue.size());
+    map.insert("inFlight", d->activeWorkers);
+
+    return map;
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::resetStatistics清零统计数据，队列中的任务数不受影响
+ */
+void DThumbnailProvider::resetStatistics()
+{
+    Q_D(DThumbnailProvider);
+
+    d->statistics.reset();
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::statisticsInterval返回发送 statisticsUpdated 信号的间隔
+ * \~chinese \return 间隔，单位为毫秒，0表示不发送
+ */
+int DThumbnailProvider::statisticsInterval() const
+{
+    Q_D(const DThumbnailProvider);
+
+    return d->statisticsTimer && d->statisticsTimer->isActive() ? d->statisticsTimer->interval() : 0;
+}
+
+/*!
+ * \~chinese \brief DThumbnailProvider::setStatisticsInterval设置定期发送 statisticsUpdated 信号的间隔
+ * \~chinese \param msec 间隔，单位为毫秒，0表示不发送，默认为0
+ * \~chinese \note 需要在 DThumbnailProvider 所在的线程中调用
+ */
+void DThumbnailProvider::setStatisticsInterval(int msec)
+{
+    Q_D(DThumbnailProvider);
+
+    if (msec <= 0)
+    {
+        if (d->statisticsTimer)
+        {
+            d->statisticsTimer->stop();
+        }
+
+        return;
+    }
+
+    if (!d->statisticsTimer)
+    {
+        d->statisticsTimer = new QTimer(this);
+
+        connect(d->statisticsTimer, &QTimer::timeout, this, [this] {
+            Q_EMIT statisticsUpdated(statistics());
+        });
+    }
+
+    d->statisticsTimer->start(msec);
 }
 
 /*!
@@ -462,48 +3666,34 @@ DThumbnailProvider::~DThumbnailProvider()
 {
     Q_D(DThumbnailProvider);
 
+    // 服务线程会调用 d 中的函数，需要先停止
+    delete d->service;
+    d->service = nullptr;
+
+    QWriteLocker locker(&d->dataReadWriteLock);
     d->running = false;
+    locker.unlock();
     d->waitCondition.wakeAll();
     wait();
+
+    for (QThread *worker : d->workers)
+    {
+        worker->wait();
+        delete worker;
+    }
+
+    if (d->garbageCollector)
+    {
+        d->garbageCollectionCanceled.storeRelease(1);
+        d->garbageCollector->wait();
+    }
 }
 
 void DThumbnailProvider::run()
 {
     Q_D(DThumbnailProvider);
 
-    Q_FOREVER
-    {
-        QWriteLocker locker(&d->dataReadWriteLock);
-
-        if (d->produceQueue.isEmpty())
-        {
-            d->waitCondition.wait(&d->dataReadWriteLock);
-        }
-
-        if (!d->running)
-        {
-            return;
-        }
-
-        const DThumbnailProviderPrivate::ProduceInfo &task = d->produceQueue.dequeue();
-        const QPair<QString, DThumbnailProvider::Size> &tmpKey = qMakePair(task.fileInfo.absoluteFilePath(), task.size);
-
-        if (d->discardedProduceInfos.contains(tmpKey))
-        {
-            d->discardedProduceInfos.remove(tmpKey);
-            locker.unlock();
-            continue;
-        }
-
-        locker.unlock();
-
-        const QString &thumbnail = createThumbnail(task.fileInfo, task.size);
-
-        if (task.callback)
-        {
-            task.callback(thumbnail);
-        }
-    }
+    d->processProduceQueue(0);
 }
 
 DGUI_END_NAMESPACE
@@ -23,10 +23,14 @@
 
 #include <QThread>
 #include <QFileInfo>
+#include <QSize>
+#include <QStringList>
+#include <QVariantMap>
 
 #include <functional>
 
 QT_BEGIN_NAMESPACE
+class QIODevice;
 class QMimeType;
 QT_END_NAMESPACE
 
@@ -42,6 +46,17 @@ public:
         Small = 64,
         Normal = 128,
         Large = 256,
+        XLarge = 512,
+        XXLarge = 1024,
+    };
+
+    struct ThumbnailResult
+    {
+        QString thumbnailPath;
+        QString errorString;
+        // 生成所用的时间，单位为毫秒
+        qint64 elapsed = 0;
+        QSize sourceSize;
     };
 
     static DThumbnailProvider *instance();
@@ -50,12 +65,65 @@ public:
     bool hasThumbnail(const QMimeType &mimeType) const;
 
     QString thumbnailFilePath(const QFileInfo &info, Size size) const;
+    QString thumbnailFilePath(const QString &cacheKey, qint64 mtime, Size size) const;
 
     QString createThumbnail(const QFileInfo &info, Size size);
+    QString createThumbnail(QIODevice *device, const QString &cacheKey, qint64 mtime, Size size);
+    QString createThumbnail(const QByteArray &data, const QString &cacheKey, qint64 mtime, Size size);
+    ThumbnailResult generateThumbnail(const QFileInfo &info, Size size);
+    QImage thumbnailImage(const QFileInfo &info, Size size);
+    QImage thumbnailImage(const QFileInfo &info, int logicalSize, qreal devicePixelRatio);
+    static Size sizeForPixelSize(int logicalSize, qreal devicePixelRatio = 1);
+    QStringList createThumbnails(const QFileInfo &info, const QList<Size> &sizes);
     typedef std::function<void(const QString &)> CallBack;
+    typedef std::function<void(const QImage &)> PreviewCallBack;
     void appendToProduceQueue(const QFileInfo &info, Size size, CallBack callback = 0);
+    void appendToProduceQueue(const QFileInfo &info, Size size, int priority, CallBack callback = 0);
+    void appendToProduceQueue(const QFileInfo &info, Size size, int priority, PreviewCallBack previewCallback, CallBack callback);
+    bool setProducePriority(const QFileInfo &info, Size size, int priority);
+    qint64 mergedProduceCount() const;
+
+    QObject *batchDeliveryTarget() const;
+    void setBatchDeliveryTarget(QObject *target);
     void removeInProduceQueue(const QFileInfo &info, Size size);
 
+    int maxThreadCount() const;
+    void setMaxThreadCount(int count);
+
+    bool progressiveThumbnailEnabled() const;
+    void setProgressiveThumbnailEnabled(bool enabled);
+
+    int readaheadCount() const;
+    void setReadaheadCount(int count);
+
+    bool thumbnailIndexEnabled() const;
+    void setThumbnailIndexEnabled(bool enabled);
+    bool rebuildThumbnailIndex();
+
+    qint64 cacheSizeLimit(Size size) const;
+    void setCacheSizeLimit(Size size, qint64 bytes);
+    int cacheEntryLimit(Size size) const;
+    void setCacheEntryLimit(Size size, int count);
+    bool collectGarbage();
+
+    QStringList extensionOnlyMimeDirectories() const;
+    void setExtensionOnlyMimeDirectories(const QStringList &directories);
+
+    bool watchDirectory(const QString &path);
+    void unwatchDirectory(const QString &path);
+    QStringList watchedDirectories() const;
+
+    bool thumbnailServiceEnabled() const;
+    void setThumbnailServiceEnabled(bool enabled);
+    bool isThumbnailServiceProvider() const;
+
+    bool externalThumbnailerEnabled() const;
+    void setExternalThumbnailerEnabled(bool enabled);
+    int externalThumbnailerTimeout() const;
+    void setExternalThumbnailerTimeout(int msec);
+    int externalThumbnailerConcurrency(const QMimeType &mimeType) const;
+    void setExternalThumbnailerConcurrency(const QMimeType &mimeType, int count);
+
     QString errorString() const;
 
     qint64 defaultSizeLimit() const;
@@ -64,10 +132,25 @@ public:
     qint64 sizeLimit(const QMimeType &mimeType) const;
     void setSizeLimit(const QMimeType &mimeType, qint64 size);
 
+    int negativeCacheTimeout() const;
+    void setNegativeCacheTimeout(int msec);
+
+    qint64 decodeMemoryLimit() const;
+    void setDecodeMemoryLimit(qint64 bytes);
+
+    QVariantMap statistics() const;
+    void resetStatistics();
+    int statisticsInterval() const;
+    void setStatisticsInterval(int msec);
+
 Q_SIGNALS:
     void thumbnailChanged(const QString &sourceFilePath, const QString &thumbnailPath) const;
     void createThumbnailFinished(const QString &sourceFilePath, const QString &thumbnailPath) const;
     void createThumbnailFailed(const QString &sourceFilePath) const;
+    void thumbnailPreviewReady(const QString &sourceFilePath, const QImage &preview) const;
+    void createThumbnailsBatchFinished(const QStringList &sourceFilePaths, const QStringList &thumbnailPaths) const;
+    void garbageCollectionFinished(qint64 reclaimedBytes, int removedCount) const;
+    void statisticsUpdated(const QVariantMap &statistics) const;
 
 protected:
     explicit DThumbnailProvider(QObject *parent = 0);
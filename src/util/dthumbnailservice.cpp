@@ -0,0 +1,997 @@
+/*
+ * Copyright (C) 2017 ~ 2017 Deepin Technology Co., Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "private/dthumbnailservice_p.h"
+
+#include <QDateTime>
+#include <QDeadlineTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QThread>
+
+#ifdef Q_OS_LINUX
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+// 较旧的 C 库头文件中没有以下定义
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#define F_GET_SEALS 1034
+#define F_SEAL_SEAL 0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#define F_SEAL_WRITE 0x0008
+#endif
+#endif
+
+DGUI_BEGIN_NAMESPACE
+
+#define SERVICE_SOCKET_NAME "/dtkgui-thumbnail.socket"
+#define SERVICE_LOCK_NAME "/dtkgui-thumbnail.lock"
+#define SERVICE_PROTOCOL_VERSION 1
+#define SERVICE_MESSAGE_LIMIT 8192
+// 等待服务回复的时限，提供服务的进程卡住时客户端不会一直阻塞
+#define SERVICE_REPLY_TIMEOUT 15000
+// 处理连接的线程数及等待处理的连接数上限
+#define SERVICE_WORKER_COUNT 4
+#define SERVICE_PENDING_LIMIT 64
+// 服务端关闭空闲超过此时长的连接，让出线程给等待中的连接，客户端下次请求时会重新连接
+#define SERVICE_IDLE_TIMEOUT 5000
+// 缓存的图片占用的内存上限
+#define SERVICE_IMAGE_CACHE_BYTES (64 * 1024 * 1024)
+#define SERVICE_IMAGE_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)
+
+// 请求：ServiceRequest 之后为 UTF-8 编码的文件路径
+struct ServiceRequest
+{
+    quint32 version;
+    qint32 size;
+};
+
+// 回复：status 为0时附带图片的 memfd，否则之后为 UTF-8 编码的错误信息
+struct ServiceResponse
+{
+    qint32 status;
+    qint32 width;
+    qint32 height;
+    qint32 bytesPerLine;
+    qint32 format;
+};
+
+#ifdef Q_OS_LINUX
+static int createMemoryFile(const char *name)
+{
+#ifdef SYS_memfd_create
+    return static_cast<int>(syscall(SYS_memfd_create, name, MFD_CLOEXEC | MFD_ALLOW_SEALING));
+#else
+    Q_UNUSED(name)
+    errno = ENOSYS;
+
+    return -1;
+#endif
+}
+
+static bool sendMessage(int socket, const QByteArray &data, int fd)
+{
+    struct iovec iov;
+    struct msghdr msg;
+    union {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = const_cast<char *>(data.constData());
+    iov.iov_len = static_cast<size_t>(data.size());
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (fd >= 0)
+    {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof(control.buffer);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    return sendmsg(socket, &msg, MSG_NOSIGNAL) == static_cast<ssize_t>(data.size());
+}
+
+static bool waitForReply(int socket, const QDeadlineTimer &deadline)
+{
+    struct pollfd fds = {socket, POLLIN, 0};
+    int ready;
+
+    do {
+        ready = poll(&fds, 1, static_cast<int>(deadline.remainingTime()));
+    } while (ready < 0 && errno == EINTR);
+
+    return ready > 0;
+}
+
+static bool receiveMessage(int socket, QByteArray *data, int *fd)
+{
+    struct iovec iov;
+    struct msghdr msg;
+    union {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+
+    data->resize(SERVICE_MESSAGE_LIMIT);
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = data->data();
+    iov.iov_len = static_cast<size_t>(data->size());
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    ssize_t length;
+
+    do {
+        length = recvmsg(socket, &msg, MSG_CMSG_CLOEXEC);
+    } while (length < 0 && errno == EINTR);
+
+    if (length <= 0)
+    {
+        return false;
+    }
+
+    data->resize(static_cast<int>(length));
+
+    int receivedFd = -1;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            memcpy(&receivedFd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+
+    if (fd)
+    {
+        *fd = receivedFd;
+    }
+    else if (receivedFd >= 0)
+    {
+        close(receivedFd);
+    }
+
+    return !(msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC));
+}
+#endif
+
+DThumbnailService::ImageFile::~ImageFile()
+{
+#ifdef Q_OS_LINUX
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+#endif
+}
+
+DThumbnailService::DThumbnailService(const Loader &loader)
+    : loader(loader)
+{
+    imageCache.setMaxCost(SERVICE_IMAGE_CACHE_BYTES);
+}
+
+DThumbnailService::~DThumbnailService()
+{
+    stop();
+}
+
+QString DThumbnailService::socketPath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation) + SERVICE_SOCKET_NAME;
+}
+
+/*
+ * 连接到会话中已有的服务，不存在时由当前进程提供服务
+ */
+bool DThumbnailService::start()
+{
+#ifdef Q_OS_LINUX
+    QMutexLocker locker(&mutex);
+    Q_UNUSED(locker)
+
+    if (running)
+    {
+        return true;
+    }
+
+    auto connectOrListen = [this] {
+        const int fd = connectToServer();
+
+        if (fd < 0)
+        {
+            return listen();
+        }
+
+        idleConnections.append(fd);
+        server = false;
+
+        return true;
+    };
+
+    running = connectOrListen();
+
+    // 其它进程正在启动服务，稍后再连接
+    for (int i = 0; i < 10 && !running; ++i)
+    {
+        QThread::msleep(20);
+        running = connectOrListen();
+    }
+
+    return running;
+#else
+    return false;
+#endif
+}
+
+void DThumbnailService::stop()
+{
+    QMutexLocker locker(&mutex);
+
+    if (!running)
+    {
+        return;
+    }
+
+    running = false;
+
+#ifdef Q_OS_LINUX
+    if (wakeFd >= 0)
+    {
+        const quint64 value = 1;
+
+        if (write(wakeFd, &value, sizeof(value)) != sizeof(value))
+        {
+            qWarning("Can not wake up thumbnail service threads");
+        }
+    }
+#endif
+
+    serving = false;
+    pendingChanged.wakeAll();
+
+    QThread *thread = serverThread;
+
+    serverThread = nullptr;
+    locker.unlock();
+
+    if (thread)
+    {
+        thread->wait();
+        delete thread;
+    }
+
+    locker.relock();
+
+    const QList<QThread *> threads = clientThreads;
+
+    clientThreads.clear();
+    locker.unlock();
+
+    for (QThread *clientThread : threads)
+    {
+        clientThread->wait();
+        delete clientThread;
+    }
+
+    locker.relock();
+
+#ifdef Q_OS_LINUX
+    while (!pendingClients.isEmpty())
+    {
+        close(pendingClients.dequeue());
+    }
+#endif
+
+    closeConnection();
+}
+
+bool DThumbnailService::isRunning() const
+{
+    QMutexLocker locker(&mutex);
+    Q_UNUSED(locker)
+
+    return running;
+}
+
+bool DThumbnailService::isServer() const
+{
+    QMutexLocker locker(&mutex);
+    Q_UNUSED(locker)
+
+    return running && server;
+}
+
+/*
+ * 请求文件的缩略图。返回的图片直接使用映射的共享内存，失败时返回空图片并设置 errorString。
+ * 每个请求独占一个连接，收发期间不持有 mutex，多个线程的请求互不等待
+ */
+QImage DThumbnailService::request(const QString &filePath, int size, QString *errorString, bool *unavailable)
+{
+#ifdef Q_OS_LINUX
+    QMutexLocker locker(&mutex);
+
+    if (!running)
+    {
+        *errorString = QStringLiteral("Thumbnail service is not running");
+
+        return QImage();
+    }
+
+    if (server)
+    {
+        locker.unlock();
+
+        ImageFile info;
+        const int fd = imageFile(filePath, size, &info, errorString);
+
+        if (fd < 0)
+        {
+            return QImage();
+        }
+
+        const QImage &image = mapImage(fd, info);
+
+        close(fd);
+
+        return image;
+    }
+
+    locker.unlock();
+
+    const ServiceRequest header {SERVICE_PROTOCOL_VERSION, size};
+    QByteArray message(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    message.append(QFileInfo(filePath).absoluteFilePath().toUtf8());
+
+    if (message.size() > SERVICE_MESSAGE_LIMIT)
+    {
+        *errorString = QStringLiteral("File path is too long: ") + filePath;
+
+        return QImage();
+    }
+
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        locker.relock();
+
+        if (!running)
+        {
+            *errorString = QStringLiteral("Thumbnail service is not running");
+
+            return QImage();
+        }
+
+        // 其它线程已接替了服务
+        if (server)
+        {
+            locker.unlock();
+
+            return request(filePath, size, errorString, unavailable);
+        }
+
+        int connection = idleConnections.isEmpty() ? connectToServer() : idleConnections.takeLast();
+
+        // 提供服务的进程已退出，由当前进程接替，或连接到已接替它的其它进程
+        if (connection < 0)
+        {
+            closeConnection();
+
+            if (listen())
+            {
+                locker.unlock();
+
+                return request(filePath, size, errorString, unavailable);
+            }
+
+            connection = connectToServer();
+
+            if (connection < 0)
+            {
+                locker.unlock();
+
+                break;
+            }
+        }
+
+        locker.unlock();
+
+        QByteArray reply;
+        int fd = -1;
+
+        const bool sent = sendMessage(connection, message, -1);
+
+        if (sent && !waitForReply(connection, QDeadlineTimer(SERVICE_REPLY_TIMEOUT)))
+        {
+            // 迟到的回复会错位，不再复用此连接
+            close(connection);
+
+            if (unavailable)
+            {
+                *unavailable = true;
+            }
+
+            *errorString = QStringLiteral("Thumbnail service timed out: ") + filePath;
+
+            return QImage();
+        }
+
+        if (!sent || !receiveMessage(connection, &reply, &fd))
+        {
+            close(connection);
+
+            // 服务已退出或已关闭空闲的连接，其它空闲的连接多半也已失效
+            locker.relock();
+
+            for (int idle : idleConnections)
+            {
+                close(idle);
+            }
+
+            idleConnections.clear();
+            locker.unlock();
+
+            continue;
+        }
+
+        locker.relock();
+
+        if (running && !server)
+        {
+            idleConnections.append(connection);
+        }
+        else
+        {
+            close(connection);
+        }
+
+        locker.unlock();
+
+        ServiceResponse response;
+
+        if (reply.size() < static_cast<int>(sizeof(response)))
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+
+            *errorString = QStringLiteral("Invalid reply received from thumbnail service");
+
+            return QImage();
+        }
+
+        memcpy(&response, reply.constData(), sizeof(response));
+
+        if (response.status != 0 || fd < 0)
+        {
+            *errorString = QString::fromUtf8(reply.mid(sizeof(response)));
+
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+
+            return QImage();
+        }
+
+        ImageFile info;
+
+        info.width = response.width;
+        info.height = response.height;
+        info.bytesPerLine = response.bytesPerLine;
+        info.format = response.format;
+
+        const QImage &image = mapImage(fd, info);
+
+        close(fd);
+
+        if (image.isNull())
+        {
+            *errorString = QStringLiteral("Invalid image received from thumbnail service");
+        }
+
+        return image;
+    }
+
+    locker.relock();
+    closeConnection();
+    running = false;
+
+    if (unavailable)
+    {
+        *unavailable = true;
+    }
+
+    *errorString = QStringLiteral("Can not connect to thumbnail service");
+
+    return QImage();
+#else
+    Q_UNUSED(filePath)
+    Q_UNUSED(size)
+
+    *errorString = QStringLiteral("Thumbnail service is not supported on this platform");
+
+    return QImage();
+#endif
+}
+
+int DThumbnailService::connectToServer()
+{
+#ifdef Q_OS_LINUX
+    const QByteArray &path = QFile::encodeName(socketPath());
+    struct sockaddr_un address;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if (path.size() >= static_cast<int>(sizeof(address.sun_path)))
+    {
+        return -1;
+    }
+
+    memcpy(address.sun_path, path.constData(), static_cast<size_t>(path.size()));
+
+    const int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    if (::connect(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0)
+    {
+        close(fd);
+
+        return -1;
+    }
+
+    return fd;
+#else
+    return -1;
+#endif
+}
+
+/*
+ * 持有锁文件的进程提供服务，锁在进程退出时自动释放，其它进程即可接替
+ */
+bool DThumbnailService::listen()
+{
+#ifdef Q_OS_LINUX
+    const QByteArray &lockPath = QFile::encodeName(QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation) + SERVICE_LOCK_NAME);
+    const QByteArray &path = QFile::encodeName(socketPath());
+    struct sockaddr_un address;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if (path.size() >= static_cast<int>(sizeof(address.sun_path)))
+    {
+        return false;
+    }
+
+    memcpy(address.sun_path, path.constData(), static_cast<size_t>(path.size()));
+
+    lockFd = open(lockPath.constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+    if (lockFd < 0)
+    {
+        return false;
+    }
+
+    if (flock(lockFd, LOCK_EX | LOCK_NB) != 0)
+    {
+        closeConnection();
+
+        return false;
+    }
+
+    // 之前提供服务的进程已退出，其套接字文件已失效
+    unlink(path.constData());
+
+    socketFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    if (socketFd < 0 || wakeFd < 0
+            || bind(socketFd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0
+            || ::listen(socketFd, SOMAXCONN) != 0)
+    {
+        closeConnection();
+
+        return false;
+    }
+
+    server = true;
+    serving = true;
+    serverThread = QThread::create([this] {
+        serve();
+    });
+    serverThread->start();
+
+    for (int i = 0; i < SERVICE_WORKER_COUNT; ++i)
+    {
+        QThread *thread = QThread::create([this] {
+            serveClients();
+        });
+
+        clientThreads.append(thread);
+        thread->start();
+    }
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+void DThumbnailService::closeConnection()
+{
+#ifdef Q_OS_LINUX
+    if (server && socketFd >= 0)
+    {
+        unlink(QFile::encodeName(socketPath()).constData());
+    }
+
+    for (int *fd : {&socketFd, &wakeFd, &lockFd})
+    {
+        if (*fd >= 0)
+        {
+            close(*fd);
+            *fd = -1;
+        }
+    }
+
+    for (int fd : idleConnections)
+    {
+        close(fd);
+    }
+#endif
+
+    idleConnections.clear();
+    server = false;
+}
+
+#ifdef Q_OS_LINUX
+void DThumbnailService::serve()
+{
+    Q_FOREVER
+    {
+        struct pollfd fds[2] = {{socketFd, POLLIN, 0}, {wakeFd, POLLIN, 0}};
+
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return;
+        }
+
+        if (fds[1].revents)
+        {
+            return;
+        }
+
+        if (!(fds[0].revents & POLLIN))
+        {
+            continue;
+        }
+
+        QMutexLocker locker(&mutex);
+
+        // 等待处理的连接已达上限时暂不接受，新的连接留在内核的队列中
+        while (serving && pendingClients.size() >= SERVICE_PENDING_LIMIT)
+        {
+            pendingChanged.wait(&mutex);
+        }
+
+        if (!serving)
+        {
+            return;
+        }
+
+        locker.unlock();
+
+        const int client = accept4(socketFd, nullptr, nullptr, SOCK_CLOEXEC);
+
+        if (client < 0)
+        {
+            continue;
+        }
+
+        // 只为同一用户的进程提供服务
+        struct ucred credentials;
+        socklen_t length = sizeof(credentials);
+
+        if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &credentials, &length) != 0 || credentials.uid != getuid())
+        {
+            close(client);
+
+            continue;
+        }
+
+        locker.relock();
+        pendingClients.enqueue(client);
+        locker.unlock();
+        pendingChanged.wakeAll();
+    }
+}
+
+/*
+ * 处理连接的线程依次取出等待处理的连接，直到服务停止
+ */
+void DThumbnailService::serveClients()
+{
+    QMutexLocker locker(&mutex);
+
+    Q_FOREVER
+    {
+        while (serving && pendingClients.isEmpty())
+        {
+            pendingChanged.wait(&mutex);
+        }
+
+        if (!serving)
+        {
+            return;
+        }
+
+        const int client = pendingClients.dequeue();
+
+        locker.unlock();
+        pendingChanged.wakeAll();
+        serveClient(client);
+        locker.relock();
+    }
+}
+
+void DThumbnailService::serveClient(int fd)
+{
+    QByteArray message;
+
+    Q_FOREVER
+    {
+        struct pollfd fds[2] = {{fd, POLLIN, 0}, {wakeFd, POLLIN, 0}};
+        const int ready = poll(fds, 2, SERVICE_IDLE_TIMEOUT);
+
+        if (ready < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            break;
+        }
+
+        // 空闲的连接不再占用线程
+        if (ready == 0 || fds[1].revents || !receiveMessage(fd, &message, nullptr) || message.size() < static_cast<int>(sizeof(ServiceRequest)))
+        {
+            break;
+        }
+
+        ServiceRequest header;
+        ServiceResponse response;
+        ImageFile info;
+        QString errorString;
+        int imageFd = -1;
+
+        memcpy(&header, message.constData(), sizeof(header));
+        memset(&response, 0, sizeof(response));
+
+        if (header.version != SERVICE_PROTOCOL_VERSION)
+        {
+            errorString = QStringLiteral("Unsupported thumbnail service protocol version");
+        }
+        else
+        {
+            imageFd = imageFile(QString::fromUtf8(message.mid(sizeof(header))), header.size, &info, &errorString);
+        }
+
+        if (imageFd < 0)
+        {
+            response.status = 1;
+        }
+        else
+        {
+            response.width = info.width;
+            response.height = info.height;
+            response.bytesPerLine = info.bytesPerLine;
+            response.format = info.format;
+        }
+
+        QByteArray reply(reinterpret_cast<const char *>(&response), sizeof(response));
+
+        if (imageFd < 0)
+        {
+            reply.append(errorString.toUtf8().left(SERVICE_MESSAGE_LIMIT - reply.size()));
+        }
+
+        const bool sent = sendMessage(fd, reply, imageFd);
+
+        if (imageFd >= 0)
+        {
+            close(imageFd);
+        }
+
+        if (!sent)
+        {
+            break;
+        }
+    }
+
+    close(fd);
+}
+
+int DThumbnailService::imageFile(const QString &filePath, int size, ImageFile *info, QString *errorString)
+{
+    const QFileInfo fileInfo(filePath);
+    const QString &key = QStringLiteral("%1:%2:%3").arg(size).arg(fileInfo.lastModified().toMSecsSinceEpoch()).arg(fileInfo.absoluteFilePath());
+
+    auto copyInfo = [info] (const ImageFile *file) {
+        info->width = file->width;
+        info->height = file->height;
+        info->bytesPerLine = file->bytesPerLine;
+        info->format = file->format;
+    };
+
+    QMutexLocker locker(&cacheMutex);
+
+    if (const ImageFile *cached = imageCache.object(key))
+    {
+        copyInfo(cached);
+
+        return fcntl(cached->fd, F_DUPFD_CLOEXEC, 0);
+    }
+
+    locker.unlock();
+
+    QImage image = loader(fileInfo.absoluteFilePath(), size, errorString);
+
+    if (image.isNull())
+    {
+        if (errorString->isEmpty())
+        {
+            *errorString = QStringLiteral("Can not create thumbnail for ") + filePath;
+        }
+
+        return -1;
+    }
+
+    // 带颜色表的格式无法直接共享像素数据
+    if (image.format() != QImage::Format_RGB32 && image.format() != QImage::Format_ARGB32_Premultiplied)
+    {
+        image = image.convertToFormat(image.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32);
+    }
+
+    const size_t length = static_cast<size_t>(image.bytesPerLine()) * static_cast<size_t>(image.height());
+    QScopedPointer<ImageFile> file(new ImageFile);
+
+    file->fd = createMemoryFile("dtkgui-thumbnail");
+
+    if (file->fd < 0 || ftruncate(file->fd, static_cast<off_t>(length)) != 0)
+    {
+        *errorString = QStringLiteral("Can not create shared memory for thumbnail: ") + QString::fromLocal8Bit(strerror(errno));
+
+        return -1;
+    }
+
+    void *data = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+
+    if (data == MAP_FAILED)
+    {
+        *errorString = QStringLiteral("Can not map shared memory for thumbnail: ") + QString::fromLocal8Bit(strerror(errno));
+
+        return -1;
+    }
+
+    memcpy(data, image.constBits(), length);
+    munmap(data, length);
+
+    // 密封后内容不能再被修改，客户端可以放心地直接映射使用
+    if (fcntl(file->fd, F_ADD_SEALS, SERVICE_IMAGE_SEALS) != 0)
+    {
+        *errorString = QStringLiteral("Can not seal shared memory for thumbnail: ") + QString::fromLocal8Bit(strerror(errno));
+
+        return -1;
+    }
+
+    file->width = image.width();
+    file->height = image.height();
+    file->bytesPerLine = image.bytesPerLine();
+    file->format = image.format();
+    copyInfo(file.data());
+
+    const int fd = fcntl(file->fd, F_DUPFD_CLOEXEC, 0);
+
+    // 以占用的字节数计算缓存开销，超过上限的图片不会被缓存
+    locker.relock();
+    imageCache.insert(key, file.take(), static_cast<int>(qMin<size_t>(length, INT_MAX)));
+
+    return fd;
+}
+
+QImage DThumbnailService::mapImage(int fd, const ImageFile &info)
+{
+    struct stat st;
+    const qint64 length = qint64(info.bytesPerLine) * info.height;
+
+    // 只映射已密封且大小足够的文件，避免其内容在使用期间被修改或截断
+    if (length <= 0 || info.width <= 0 || info.bytesPerLine < info.width * 4
+            || (info.format != QImage::Format_RGB32 && info.format != QImage::Format_ARGB32_Premultiplied)
+            || fstat(fd, &st) != 0 || st.st_size < length
+            || (fcntl(fd, F_GET_SEALS) & SERVICE_IMAGE_SEALS) != SERVICE_IMAGE_SEALS)
+    {
+        return QImage();
+    }
+
+    void *data = mmap(nullptr, static_cast<size_t>(length), PROT_READ, MAP_SHARED, fd, 0);
+
+    if (data == MAP_FAILED)
+    {
+        return QImage();
+    }
+
+    struct Mapping
+    {
+        void *data;
+        size_t length;
+    };
+
+    return QImage(static_cast<const uchar *>(data), info.width, info.height, info.bytesPerLine,
+                  static_cast<QImage::Format>(info.format), [] (void *info) {
+        Mapping *mapping = static_cast<Mapping *>(info);
+
+        munmap(mapping->data, mapping->length);
+        delete mapping;
+    }, new Mapping {data, static_cast<size_t>(length)});
+}
+#endif
+
+DGUI_END_NAMESPACE
@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2017 ~ 2017 Deepin Technology Co., Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "private/dthumbnailstatistics_p.h"
+
+#include <QHash>
+
+DGUI_BEGIN_NAMESPACE
+
+void DThumbnailStatistics::Histogram::record(qint64 nsecs)
+{
+    quint64 usecs = static_cast<quint64>(qMax<qint64>(0, nsecs)) / 1000;
+    int bucket = 0;
+
+    while (usecs && bucket < HistogramBuckets - 1)
+    {
+        usecs >>= 1;
+        ++bucket;
+    }
+
+    count.fetchAndAddRelaxed(1);
+    totalNsecs.fetchAndAddRelaxed(static_cast<quint64>(qMax<qint64>(0, nsecs)));
+    buckets[bucket].fetchAndAddRelaxed(1);
+}
+
+QVariantMap DThumbnailStatistics::Histogram::toVariantMap() const
+{
+    QVariantList values;
+
+    for (const QAtomicInteger<quint64> &bucket : buckets)
+    {
+        values.append(bucket.load());
+    }
+
+    // 去掉末尾的空区间
+    while (!values.isEmpty() && values.last().toULongLong() == 0)
+    {
+        values.removeLast();
+    }
+
+    return {
+        {"count", count.load()},
+        {"totalMsecs", totalNsecs.load() / 1e6},
+        {"buckets", values}
+    };
+}
+
+void DThumbnailStatistics::Histogram::reset()
+{
+    count.store(0);
+    totalNsecs.store(0);
+
+    for (QAtomicInteger<quint64> &bucket : buckets)
+    {
+        bucket.store(0);
+    }
+}
+
+DThumbnailStatistics::DThumbnailStatistics()
+{
+    reset();
+
+    for (MimeTypeSlot &slot : mimeTypeSlots)
+    {
+        slot.name.store(nullptr);
+    }
+}
+
+DThumbnailStatistics::~DThumbnailStatistics()
+{
+    for (MimeTypeSlot &slot : mimeTypeSlots)
+    {
+        delete slot.name.load();
+    }
+}
+
+void DThumbnailStatistics::add(DThumbnailStatistics::Counter counter, qint64 value)
+{
+    counters[counter].fetchAndAddRelaxed(value);
+}
+
+void DThumbnailStatistics::recordDecode(const QString &mimeType, qint64 nsecs)
+{
+    decodeHistogram(mimeType)->record(nsecs);
+}
+
+void DThumbnailStatistics::recordWrite(qint64 nsecs)
+{
+    writeHistogram.record(nsecs);
+}
+
+QVariantMap DThumbnailStatistics::toVariantMap() const
+{
+    static const char *names[CounterCount] = {
+        "cacheHits",
+        "cacheMisses",
+        "cacheStale",
+        "thumbnailsCreated",
+        "thumbnailsFailed",
+        "bytesWritten"
+    };
+
+    QVariantMap map;
+    QVariantMap decodeLatency;
+
+    for (int i = 0; i < CounterCount; ++i)
+    {
+        map.insert(names[i], counters[i].load());
+    }
+
+    for (const MimeTypeSlot &slot : mimeTypeSlots)
+    {
+        if (const QByteArray *name = slot.name.loadAcquire())
+        {
+            decodeLatency.insert(QString::fromLatin1(*name), slot.histogram.toVariantMap());
+        }
+    }
+
+    if (otherDecodeHistogram.count.load() > 0)
+    {
+        decodeLatency.insert("*", otherDecodeHistogram.toVariantMap());
+    }
+
+    map.insert("decodeLatency", decodeLatency);
+    map.insert("writeLatency", writeHistogram.toVariantMap());
+
+    return map;
+}
+
+/*
+ * 清零所有计数器，已占用的 MIME 类型槽位保留
+ */
+void DThumbnailStatistics::reset()
+{
+    for (QAtomicInteger<qint64> &counter : counters)
+    {
+        counter.store(0);
+    }
+
+    writeHistogram.reset();
+    otherDecodeHistogram.reset();
+
+    for (MimeTypeSlot &slot : mimeTypeSlots)
+    {
+        slot.histogram.reset();
+    }
+}
+
+/*
+ * 以 MIME 类型的哈希值为起点线性探测，槽位一旦占用就不再释放，查找时无需加锁
+ */
+DThumbnailStatistics::Histogram *DThumbnailStatistics::decodeHistogram(const QString &mimeType)
+{
+    const QByteArray &name = mimeType.toLatin1();
+    const uint start = qHash(name);
+
+    for (int i = 0; i < MimeTypeSlots; ++i)
+    {
+        MimeTypeSlot &slot = mimeTypeSlots[(start + i) % MimeTypeSlots];
+        const QByteArray *slotName = slot.name.loadAcquire();
+
+        if (!slotName)
+        {
+            QByteArray *newName = new QByteArray(name);
+
+            if (slot.name.testAndSetOrdered(nullptr, newName))
+            {
+                return &slot.histogram;
+            }
+
+            delete newName;
+            slotName = slot.name.loadAcquire();
+        }
+
+        if (*slotName == name)
+        {
+            return &slot.histogram;
+        }
+    }
+
+    return &otherDecodeHistogram;
+}
+
+DGUI_END_NAMESPACE
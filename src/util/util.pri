@@ -6,7 +6,12 @@ HEADERS += \
     $$PWD/dthumbnailprovider.h
 
 SOURCES += \
+    $$PWD/dexternalthumbnailer.cpp \
     $$PWD/dfontmanager.cpp \
+    $$PWD/dimagescaler.cpp \
     $$PWD/dsvgrenderer.cpp \
     $$PWD/dtaskbarcontrol.cpp \
-    $$PWD/dthumbnailprovider.cpp
+    $$PWD/dthumbnailindex.cpp \
+    $$PWD/dthumbnailprovider.cpp \
+    $$PWD/dthumbnailservice.cpp \
+    $$PWD/dthumbnailstatistics.cpp
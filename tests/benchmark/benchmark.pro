@@ -0,0 +1,25 @@
+# 缩略图性能测试，结果以 JSON 格式输出，便于在 CI 中与之前的版本比较：
+#   thumbnail-benchmark --output result.json
+QT += dtkcore core-private gui gui-private
+
+TARGET = thumbnail-benchmark
+TEMPLATE = app
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+SOURCES += \
+    main.cpp \
+    corpus.cpp \
+    $$PWD/../../src/util/dimagescaler.cpp
+
+HEADERS += \
+    corpus.h
+
+INCLUDEPATH += \
+    $$PWD/../../src \
+    $$PWD/../../src/util \
+    $$PWD/../../src/private
+
+unix: LIBS += -L$$OUT_PWD/../../src -ldtkgui
+unix: QMAKE_RPATHDIR += $$OUT_PWD/../../src
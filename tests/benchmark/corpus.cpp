@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2021 ~ 2021 Deepin Technology Co., Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "corpus.h"
+
+#include <QBuffer>
+#include <QDir>
+#include <QFile>
+#include <QImage>
+#include <QImageWriter>
+#include <QPainter>
+#include <QRandomGenerator>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// 渐变背景加随机的色块，使编码后的大小接近真实的照片
+static QImage createImage(const QSize &size, QRandomGenerator *random)
+{
+    QImage image(size, QImage::Format_RGB32);
+    QPainter painter(&image);
+    QLinearGradient gradient(0, 0, size.width(), size.height());
+
+    gradient.setColorAt(0, QColor::fromRgb(random->generate()));
+    gradient.setColorAt(1, QColor::fromRgb(random->generate()));
+    painter.fillRect(image.rect(), gradient);
+
+    for (int i = 0; i < 64; ++i)
+    {
+        const QRect rect(random->bounded(size.width()), random->bounded(size.height()),
+                         random->bounded(size.width() / 4 + 1), random->bounded(size.height() / 4 + 1));
+
+        painter.fillRect(rect, QColor::fromRgba(random->generate() | 0x40000000));
+    }
+
+    painter.end();
+
+    // 加入噪点，避免图片过于容易压缩
+    for (int y = 0; y < image.height(); y += 3)
+    {
+        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+
+        for (int x = random->bounded(3); x < image.width(); x += 3)
+        {
+            line[x] ^= random->generate() & 0x000f0f0f;
+        }
+    }
+
+    return image;
+}
+
+bool Corpus::generate(const QString &directory, const Options &options)
+{
+    QRandomGenerator random(options.seed);
+    const QList<QByteArray> &supportedFormats = QImageWriter::supportedImageFormats();
+
+    fileInfos.clear();
+    usedFormats.clear();
+    corrupt = 0;
+    bytes = 0;
+
+    for (const QString &format : options.formats)
+    {
+        if (supportedFormats.contains(format.toLatin1()))
+        {
+            usedFormats.append(format);
+        }
+    }
+
+    if (usedFormats.isEmpty() || options.resolutions.isEmpty() || !QDir().mkpath(directory))
+    {
+        return false;
+    }
+
+    for (int i = 0; i < options.fileCount; ++i)
+    {
+        const QString &format = usedFormats.at(i % usedFormats.size());
+        const QSize &size = options.resolutions.at(random.bounded(options.resolutions.size()));
+        const QString &fileName = QStringLiteral("%1/%2-%3x%4.%5").arg(directory).arg(i, 5, 10, QLatin1Char('0'))
+                .arg(size.width()).arg(size.height()).arg(format);
+        QByteArray data;
+        QBuffer buffer(&data);
+
+        buffer.open(QIODevice::WriteOnly);
+
+        if (!createImage(size, &random).save(&buffer, format.toLatin1().constData(), 85))
+        {
+            return false;
+        }
+
+        // 截断并破坏部分数据，文件头仍然有效，只有解码时才会失败
+        if (int(random.bounded(100)) < options.corruptPercent)
+        {
+            data.truncate(data.size() / 2);
+
+            for (int j = 64; j < data.size(); j += 97)
+            {
+                data[j] = static_cast<char>(random.generate());
+            }
+
+            ++corrupt;
+        }
+
+        QFile file(fileName);
+
+        if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size())
+        {
+            return false;
+        }
+
+        file.close();
+        fileInfos.append(QFileInfo(fileName));
+        bytes += data.size();
+    }
+
+    return true;
+}
+
+QList<QFileInfo> Corpus::files() const
+{
+    return fileInfos;
+}
+
+QStringList Corpus::formats() const
+{
+    return usedFormats;
+}
+
+int Corpus::corruptCount() const
+{
+    return corrupt;
+}
+
+qint64 Corpus::totalBytes() const
+{
+    return bytes;
+}
+
+void Corpus::dropPageCache() const
+{
+    for (const QFileInfo &info : fileInfos)
+    {
+        const int fd = ::open(QFile::encodeName(info.absoluteFilePath()).constData(), O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0)
+        {
+            continue;
+        }
+
+        // 已写回磁盘的页才能被丢弃
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        ::close(fd);
+    }
+}
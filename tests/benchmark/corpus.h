@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2021 ~ 2021 Deepin Technology Co., Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <QFileInfo>
+#include <QList>
+#include <QSize>
+#include <QStringList>
+
+/*
+ * 生成可重现的测试图片：相同的种子与参数总是生成相同的文件
+ */
+class Corpus
+{
+public:
+    struct Options
+    {
+        quint32 seed = 1;
+        int fileCount = 200;
+        // 损坏文件所占的百分比
+        int corruptPercent = 10;
+        QList<QSize> resolutions {QSize(320, 240), QSize(1280, 720), QSize(1920, 1080), QSize(4032, 3024)};
+        QStringList formats {"jpg", "png", "webp"};
+    };
+
+    bool generate(const QString &directory, const Options &options);
+
+    QList<QFileInfo> files() const;
+    QStringList formats() const;
+    int corruptCount() const;
+    qint64 totalBytes() const;
+
+    // 将文件从页缓存中移除，模拟冷缓存
+    void dropPageCache() const;
+
+private:
+    QList<QFileInfo> fileInfos;
+    QStringList usedFormats;
+    int corrupt = 0;
+    qint64 bytes = 0;
+};
+
+#endif // CORPUS_H
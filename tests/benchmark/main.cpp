@@ -0,0 +1,327 @@
+/*
+ * Copyright (C) 2021 ~ 2021 Deepin Technology Co., Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "corpus.h"
+#include "dthumbnailprovider.h"
+#include "private/dimagescaler_p.h"
+
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QGuiApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSemaphore>
+#include <QSysInfo>
+#include <QTemporaryDir>
+#include <QThread>
+
+#include <algorithm>
+
+#include <sys/resource.h>
+
+DGUI_USE_NAMESPACE
+
+#define BENCHMARK_VERSION 1
+// 队列测试的最长等待时间
+#define QUEUE_TIMEOUT (10 * 60 * 1000)
+
+class Benchmark
+{
+public:
+    explicit Benchmark(const QString &cacheDirectory)
+        : cacheDirectory(cacheDirectory)
+        , provider(DThumbnailProvider::instance())
+    {
+
+    }
+
+    void addResult(const QString &name, double value, const QString &unit)
+    {
+        results.append(QJsonObject {{"name", name}, {"value", value}, {"unit", unit}});
+    }
+
+    // 记录一组耗时的吞吐量与分位数，单位为纳秒
+    void addLatencies(const QString &name, QVector<qint64> latencies, qint64 elapsed)
+    {
+        if (latencies.isEmpty())
+        {
+            return;
+        }
+
+        std::sort(latencies.begin(), latencies.end());
+
+        addResult(name + ".throughput", latencies.size() * 1e9 / qMax<qint64>(1, elapsed), "files/s");
+        addResult(name + ".p50", latencies.at(latencies.size() / 2) / 1e6, "ms");
+        addResult(name + ".p95", latencies.at(latencies.size() * 95 / 100) / 1e6, "ms");
+        addResult(name + ".max", latencies.last() / 1e6, "ms");
+    }
+
+    void addPeakMemory(const QString &phase)
+    {
+        struct rusage usage;
+
+        if (getrusage(RUSAGE_SELF, &usage) == 0)
+        {
+            addResult("peakRss." + phase, usage.ru_maxrss / 1024.0, "MiB");
+        }
+    }
+
+    // 清空缩略图目录及内存中的失败记录，之后的生成都从源文件解码
+    void clearThumbnailCache()
+    {
+        QDir(cacheDirectory + "/thumbnails").removeRecursively();
+
+        const int timeout = provider->negativeCacheTimeout();
+
+        provider->setNegativeCacheTimeout(0);
+        provider->setNegativeCacheTimeout(timeout);
+    }
+
+    void runCreateThumbnail(const QString &name, const QList<QFileInfo> &files)
+    {
+        QVector<qint64> latencies;
+        QElapsedTimer total;
+        QElapsedTimer timer;
+
+        latencies.reserve(files.size());
+        total.start();
+
+        for (const QFileInfo &info : files)
+        {
+            timer.start();
+            provider->createThumbnail(info, DThumbnailProvider::Normal);
+            latencies.append(timer.nsecsElapsed());
+        }
+
+        addLatencies(name, latencies, total.nsecsElapsed());
+    }
+
+    void runThumbnailFilePath(const QString &name, const QList<QFileInfo> &files)
+    {
+        QVector<qint64> latencies;
+        QElapsedTimer total;
+        QElapsedTimer timer;
+
+        latencies.reserve(files.size());
+        total.start();
+
+        for (const QFileInfo &info : files)
+        {
+            timer.start();
+            provider->thumbnailFilePath(info, DThumbnailProvider::Normal);
+            latencies.append(timer.nsecsElapsed());
+        }
+
+        std::sort(latencies.begin(), latencies.end());
+
+        addResult(name + ".p50", latencies.at(latencies.size() / 2) / 1e3, "us");
+        addResult(name + ".p95", latencies.at(latencies.size() * 95 / 100) / 1e3, "us");
+    }
+
+    bool runQueue(int threadCount, const QList<QFileInfo> &files)
+    {
+        QSemaphore finished;
+        QElapsedTimer timer;
+
+        provider->setMaxThreadCount(threadCount);
+        timer.start();
+
+        for (const QFileInfo &info : files)
+        {
+            provider->appendToProduceQueue(info, DThumbnailProvider::Normal, [&finished] (const QString &) {
+                finished.release();
+            });
+        }
+
+        if (!finished.tryAcquire(files.size(), QUEUE_TIMEOUT))
+        {
+            return false;
+        }
+
+        addResult(QStringLiteral("queue.threads%1.throughput").arg(threadCount),
+                  files.size() * 1e9 / qMax<qint64>(1, timer.nsecsElapsed()), "files/s");
+
+        return true;
+    }
+
+    void runScaler(int iterations)
+    {
+        const QSize sourceSize(4032, 3024);
+        const QSize targetSize(256, 256);
+        QImage source(sourceSize, QImage::Format_ARGB32_Premultiplied);
+
+        for (int y = 0; y < source.height(); ++y)
+        {
+            QRgb *line = reinterpret_cast<QRgb *>(source.scanLine(y));
+
+            for (int x = 0; x < source.width(); ++x)
+            {
+                line[x] = qRgba(x & 0xff, y & 0xff, (x ^ y) & 0xff, 0xff);
+            }
+        }
+
+        QElapsedTimer timer;
+
+        timer.start();
+
+        for (int i = 0; i < iterations; ++i)
+        {
+            DImageScaler::scaled(source, targetSize, Qt::KeepAspectRatio);
+        }
+
+        addResult("scale.DImageScaler", timer.nsecsElapsed() / 1e6 / iterations, "ms");
+        timer.restart();
+
+        for (int i = 0; i < iterations; ++i)
+        {
+            source.scaled(targetSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        }
+
+        addResult("scale.QImageSmooth", timer.nsecsElapsed() / 1e6 / iterations, "ms");
+    }
+
+    QString cacheDirectory;
+    DThumbnailProvider *provider;
+    QJsonArray results;
+};
+
+int main(int argc, char *argv[])
+{
+    // 缩略图写入临时目录，不影响用户的缓存
+    QTemporaryDir workspace;
+
+    if (!workspace.isValid())
+    {
+        qCritical("Can not create temporary directory");
+        return 1;
+    }
+
+    const QString &cacheDirectory = workspace.filePath("cache");
+
+    qputenv("XDG_CACHE_HOME", QFile::encodeName(cacheDirectory));
+
+    if (!qEnvironmentVariableIsSet("DISPLAY"))
+    {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    QGuiApplication app(argc, argv);
+    QCommandLineParser parser;
+    const QCommandLineOption outputOption({"o", "output"}, "Write the JSON results to <file> instead of stdout.", "file");
+    const QCommandLineOption filesOption("files", "Number of files in the corpus.", "count", "200");
+    const QCommandLineOption seedOption("seed", "Seed of the corpus generator.", "seed", "1");
+    const QCommandLineOption corruptOption("corrupt-percent", "Percentage of corrupt files.", "percent", "10");
+    const QCommandLineOption threadsOption("threads", "Comma separated worker thread counts for the queue benchmark.", "counts",
+                                           QStringLiteral("1,2,4,%1").arg(QThread::idealThreadCount()));
+    const QCommandLineOption corpusOption("corpus", "Generate the corpus in <directory> and keep it.", "directory");
+
+    parser.setApplicationDescription("Thumbnail throughput benchmark");
+    parser.addHelpOption();
+    parser.addOptions({outputOption, filesOption, seedOption, corruptOption, threadsOption, corpusOption});
+    parser.process(app);
+
+    Corpus corpus;
+    Corpus::Options options;
+
+    options.fileCount = qMax(1, parser.value(filesOption).toInt());
+    options.seed = parser.value(seedOption).toUInt();
+    options.corruptPercent = qBound(0, parser.value(corruptOption).toInt(), 100);
+
+    const QString &corpusDirectory = parser.isSet(corpusOption) ? parser.value(corpusOption) : workspace.filePath("corpus");
+
+    if (!corpus.generate(corpusDirectory, options))
+    {
+        qCritical("Can not generate the corpus in %s", qPrintable(corpusDirectory));
+        return 1;
+    }
+
+    const QList<QFileInfo> &files = corpus.files();
+    Benchmark benchmark(cacheDirectory);
+
+    benchmark.addPeakMemory("start");
+
+    // 冷缓存：源文件不在页缓存中，缩略图目录为空
+    benchmark.clearThumbnailCache();
+    corpus.dropPageCache();
+    benchmark.runCreateThumbnail("createThumbnail.cold", files);
+    benchmark.addPeakMemory("createThumbnail");
+
+    // 热缓存：源文件已在页缓存中
+    benchmark.clearThumbnailCache();
+    benchmark.runCreateThumbnail("createThumbnail.warm", files);
+
+    benchmark.runThumbnailFilePath("thumbnailFilePath.hit", files);
+    benchmark.clearThumbnailCache();
+    benchmark.runThumbnailFilePath("thumbnailFilePath.miss", files);
+
+    for (const QString &value : parser.value(threadsOption).split(',', QString::SkipEmptyParts))
+    {
+        const int threadCount = value.toInt();
+
+        if (threadCount <= 0)
+        {
+            continue;
+        }
+
+        benchmark.clearThumbnailCache();
+        corpus.dropPageCache();
+
+        if (!benchmark.runQueue(threadCount, files))
+        {
+            qCritical("Queue benchmark with %d threads timed out", threadCount);
+            return 1;
+        }
+    }
+
+    benchmark.addPeakMemory("queue");
+    benchmark.runScaler(10);
+
+    const QJsonObject report {
+        {"version", BENCHMARK_VERSION},
+        {"qtVersion", QString(qVersion())},
+        {"cpu", QSysInfo::currentCpuArchitecture()},
+        {"idealThreadCount", QThread::idealThreadCount()},
+        {"corpus", QJsonObject {
+             {"seed", double(options.seed)},
+             {"files", files.size()},
+             {"corrupt", corpus.corruptCount()},
+             {"bytes", double(corpus.totalBytes())},
+             {"formats", QJsonArray::fromStringList(corpus.formats())}
+         }},
+        {"results", benchmark.results}
+    };
+    const QByteArray &json = QJsonDocument(report).toJson();
+
+    if (!parser.isSet(outputOption))
+    {
+        fputs(json.constData(), stdout);
+
+        return 0;
+    }
+
+    QFile output(parser.value(outputOption));
+
+    if (!output.open(QIODevice::WriteOnly | QIODevice::Truncate) || output.write(json) != json.size())
+    {
+        qCritical("Can not write %s", qPrintable(output.fileName()));
+        return 1;
+    }
+
+    return 0;
+}
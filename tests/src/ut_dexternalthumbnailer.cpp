@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2021 ~ 2021 Deepin Technology Co., Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+#include "private/dexternalthumbnailer_p.h"
+
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+
+DGUI_USE_NAMESPACE
+
+TEST(TDExternalThumbnailer, TestSplitCommand)
+{
+    ASSERT_EQ(DExternalThumbnailer::splitCommand("thumbnailer -s %s  %u %o"),
+              QStringList({"thumbnailer", "-s", "%s", "%u", "%o"}));
+    ASSERT_EQ(DExternalThumbnailer::splitCommand("\"/opt/my app/bin\" \"a \\\"b\\\"\" \"\""),
+              QStringList({"/opt/my app/bin", "a \"b\"", ""}));
+}
+
+TEST(TDExternalThumbnailer, TestCreate)
+{
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+
+    const QString &source = dir.filePath("source.png");
+    QImage image(32, 16, QImage::Format_ARGB32);
+    image.fill(Qt::red);
+    ASSERT_TRUE(image.save(source));
+
+    DExternalThumbnailer thumbnailer;
+
+    // 不读取系统中的 .thumbnailer 文件，直接注册一个复制源文件的程序
+    thumbnailer.loaded = true;
+    thumbnailer.thumbnailers.insert("image/x-test", {"test.thumbnailer", "cp %i %o"});
+    thumbnailer.thumbnailers.insert("image/x-fail", {"fail.thumbnailer", "false %i %o"});
+
+    ASSERT_FALSE(thumbnailer.supports("image/x-test"));
+    thumbnailer.setEnabled(true);
+    ASSERT_TRUE(thumbnailer.supports("image/x-test"));
+    ASSERT_FALSE(thumbnailer.supports("image/png"));
+
+    QString errorString;
+    const QImage &thumbnail = thumbnailer.create(source, "image/x-test", 128, &errorString);
+
+    ASSERT_TRUE(errorString.isEmpty());
+    ASSERT_EQ(thumbnail.size(), image.size());
+
+    thumbnailer.create(source, "image/x-fail", 128, &errorString);
+    ASSERT_FALSE(errorString.isEmpty());
+}
+
+TEST(TDExternalThumbnailer, TestSlotTimeout)
+{
+    DExternalThumbnailer thumbnailer;
+
+    thumbnailer.loaded = true;
+    thumbnailer.thumbnailers.insert("image/x-test", {"test.thumbnailer", "cp %i %o"});
+    thumbnailer.setEnabled(true);
+    thumbnailer.setTimeout(100);
+
+    // 模拟已有卡住的进程占满了同一 MIME 类型的名额
+    thumbnailer.runningCounts.insert("image/x-test", thumbnailer.concurrency("image/x-test"));
+
+    QString errorString;
+    QElapsedTimer timer;
+    timer.start();
+
+    ASSERT_TRUE(thumbnailer.create("/tmp/none.png", "image/x-test", 128, &errorString).isNull());
+    ASSERT_FALSE(errorString.isEmpty());
+    ASSERT_LT(timer.elapsed(), 5000);
+}
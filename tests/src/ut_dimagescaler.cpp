@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2021 ~ 2021 Deepin Technology Co., Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+#include "private/dimagescaler_p.h"
+
+DGUI_USE_NAMESPACE
+
+TEST(TDImageScaler, TestSize)
+{
+    QImage image(300, 200, QImage::Format_RGB888);
+    image.fill(Qt::red);
+
+    const QImage &scaled = DImageScaler::scaled(image, QSize(128, 128), Qt::KeepAspectRatio);
+    ASSERT_EQ(scaled.size(), QSize(128, 85));
+    ASSERT_EQ(scaled.format(), QImage::Format_RGB32);
+    ASSERT_EQ(scaled.pixel(0, 0), QColor(Qt::red).rgb());
+    ASSERT_EQ(scaled.pixel(127, 84), QColor(Qt::red).rgb());
+
+    // 放大与大小不变时不做面积平均
+    ASSERT_EQ(DImageScaler::scaled(image, QSize(600, 400)).size(), QSize(600, 400));
+    ASSERT_EQ(DImageScaler::scaled(image, image.size()), image);
+    ASSERT_TRUE(DImageScaler::scaled(QImage(), QSize(16, 16)).isNull());
+}
+
+TEST(TDImageScaler, TestAreaAverage)
+{
+    // 单像素的棋盘格缩小后每个像素都应为灰色，不会产生摩尔纹
+    QImage checker(515, 515, QImage::Format_RGB32);
+
+    for (int y = 0; y < checker.height(); ++y)
+    {
+        for (int x = 0; x < checker.width(); ++x)
+        {
+            checker.setPixel(x, y, (x + y) % 2 ? qRgb(255, 255, 255) : qRgb(0, 0, 0));
+        }
+    }
+
+    for (const QSize &size : {QSize(64, 64), QSize(100, 100), QSize(257, 257)})
+    {
+        const QImage &scaled = DImageScaler::scaled(checker, size);
+        ASSERT_EQ(scaled.size(), size);
+
+        for (int y = 0; y < scaled.height(); ++y)
+        {
+            for (int x = 0; x < scaled.width(); ++x)
+            {
+                ASSERT_NEAR(qGray(scaled.pixel(x, y)), 128, 8);
+                ASSERT_EQ(qAlpha(scaled.pixel(x, y)), 255);
+            }
+        }
+    }
+}
+
+TEST(TDImageScaler, TestPremultipliedAlpha)
+{
+    // 透明部分的颜色不应混入结果
+    QImage image(64, 64, QImage::Format_ARGB32);
+    image.fill(Qt::transparent);
+
+    for (int y = 0; y < image.height(); ++y)
+    {
+        for (int x = 0; x < image.width(); x += 2)
+        {
+            image.setPixel(x, y, qRgba(255, 0, 0, 255));
+        }
+    }
+
+    const QImage &scaled = DImageScaler::scaled(image, QSize(8, 8));
+    ASSERT_EQ(scaled.format(), QImage::Format_ARGB32_Premultiplied);
+
+    const QColor &color = QColor::fromRgba(scaled.pixel(3, 3));
+    ASSERT_NEAR(color.alpha(), 128, 1);
+    ASSERT_EQ(color.red(), 255);
+    ASSERT_EQ(color.green(), 0);
+}
+
+TEST(TDImageScaler, TestReduce)
+{
+    // 宽度不是整数倍时多余的列被忽略，不会越界
+    QImage image(37, 9, QImage::Format_RGB32);
+    image.fill(qRgb(10, 20, 30));
+
+    for (int y = 0; y < image.height(); ++y)
+    {
+        image.setPixel(36, y, qRgb(255, 255, 255));
+    }
+
+    QImage reduced;
+    DImageScaler::reduce(image, &reduced, 4, 3);
+    ASSERT_EQ(reduced.size(), QSize(9, 3));
+
+    for (int x = 0; x < reduced.width(); ++x)
+    {
+        ASSERT_EQ(reduced.pixel(x, 2), qRgb(10, 20, 30));
+    }
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2021 ~ 2021 Deepin Technology Co., Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+#include "private/dthumbnailindex_p.h"
+
+#include <QCryptographicHash>
+#include <QTemporaryDir>
+
+DGUI_USE_NAMESPACE
+
+static QByteArray hashOf(const QByteArray &url)
+{
+    return QCryptographicHash::hash(url, QCryptographicHash::Md5);
+}
+
+TEST(TDThumbnailIndex, TestInsertAndFind)
+{
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+
+    DThumbnailIndex index(dir.path());
+    const QByteArray &hash = hashOf("file:///tmp/a.png");
+
+    ASSERT_EQ(index.find(hash).state, DThumbnailIndex::Unknown);
+    ASSERT_TRUE(index.insert(hash, DThumbnailIndex::Valid, 100, 200));
+
+    DThumbnailIndex::Entry entry = index.find(hash);
+    ASSERT_EQ(entry.state, DThumbnailIndex::Valid);
+    ASSERT_EQ(entry.mtime, 100);
+    ASSERT_EQ(entry.size, 200);
+
+    // 其它进程打开同一个索引文件时能看到相同的内容
+    DThumbnailIndex other(dir.path());
+    ASSERT_EQ(other.find(hash).state, DThumbnailIndex::Valid);
+
+    ASSERT_TRUE(index.remove(hash));
+    ASSERT_EQ(other.find(hash).state, DThumbnailIndex::Removed);
+}
+
+TEST(TDThumbnailIndex, TestReset)
+{
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+
+    DThumbnailIndex index(dir.path());
+    DThumbnailIndex other(dir.path());
+    QList<DThumbnailIndex::Entry> entries;
+
+    ASSERT_TRUE(other.insert(hashOf("file:///tmp/old.png"), DThumbnailIndex::Valid, 1, 1));
+
+    for (int i = 0; i < 20000; ++i)
+    {
+        DThumbnailIndex::Entry entry;
+        entry.hash = hashOf(QByteArray::number(i));
+        entry.state = DThumbnailIndex::Failed;
+        entry.mtime = i;
+        entries.append(entry);
+    }
+
+    ASSERT_TRUE(index.reset(entries));
+    ASSERT_EQ(index.find(hashOf("12345")).mtime, 12345);
+
+    // 索引文件被替换后，之前打开的实例会重新映射新的文件
+    ASSERT_EQ(other.find(hashOf("file:///tmp/old.png")).state, DThumbnailIndex::Unknown);
+    ASSERT_EQ(other.find(hashOf("19999")).state, DThumbnailIndex::Failed);
+}
@@ -20,81 +20,158 @@
  */
 #include "test.h"
 #include "dthumbnailprovider.h"
+#include "private/dthumbnailprovider_p.h"
+#include "private/dthumbnailindex_p.h"
 
-#include <DObjectPrivate>
+#include <QBuffer>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QElapsedTimer>
 #include <QMimeDatabase>
-#include <QQueue>
-#include <QReadWriteLock>
-#include <QSet>
 #include <QSignalSpy>
-#include <QWaitCondition>
 #include <QDebug>
 #include <QImageReader>
-
-DGUI_BEGIN_NAMESPACE
-#ifndef UT_DThumbnailProviderPrivate
-#define UT_DThumbnailProviderPrivate
-class DThumbnailProviderPrivate : public DTK_CORE_NAMESPACE::DObjectPrivate
-{
-public:
-    DThumbnailProviderPrivate(DThumbnailProvider *qq);
-
-    void init();
-
-    QString sizeToFilePath(DThumbnailProvider::Size size) const;
-
-    QString errorString;
-    // MAX
-    qint64 defaultSizeLimit = INT64_MAX;
-    QHash<QMimeType, qint64> sizeLimitHash;
-    QMimeDatabase mimeDatabase;
-
-    static QSet<QString> hasThumbnailMimeHash;
-
-    struct ProduceInfo
-    {
-        QFileInfo fileInfo;
-        DThumbnailProvider::Size size;
-        DThumbnailProvider::CallBack callback;
-    };
-
-    QQueue<ProduceInfo> produceQueue;
-    QSet<QPair<QString, DThumbnailProvider::Size>> discardedProduceInfos;
-
-    bool running = true;
-
-    QWaitCondition waitCondition;
-    QReadWriteLock dataReadWriteLock;
-
-    D_DECLARE_PUBLIC(DThumbnailProvider)
-};
-#endif
-DGUI_END_NAMESPACE
+#include <QSharedPointer>
+#include <QTemporaryDir>
+#include <QUrl>
 
 DGUI_USE_NAMESPACE
 
 class TDThumbnailProvider : public DTest
 {
 protected:
+    static void SetUpTestCase();
+    static void TearDownTestCase();
     void SetUp();
     void TearDown();
 
+    // 在临时目录中保存纯色图片，格式由扩展名决定，失败时返回空
+    QString createImage(const QString &fileName, const QSize &size, const QColor &color) const;
+    // 以 Normal 大小加入 d 的生成队列
+    static void enqueue(DThumbnailProviderPrivate *d, const QString &file, int priority,
+                        DThumbnailProvider::CallBack callback = nullptr);
+    // 等待生成队列为空且没有正在生成的任务，回调可能仍在送达
+    bool waitForProduceQueue(int timeout) const;
+
     DThumbnailProvider *provider;
     DThumbnailProviderPrivate *provider_d;
+    QTemporaryDir dir;
+
+    // 单例中会被测试修改的状态，每个测试结束后恢复
+    bool running;
+    qint64 defaultSizeLimit;
+    QHash<QMimeType, qint64> sizeLimitHash;
+
+    // 缩略图缓存目录，避免读写用户真实的 ~/.cache/thumbnails
+    static QTemporaryDir *cacheDir;
+    static QByteArray cacheHome;
 };
 
+QTemporaryDir *TDThumbnailProvider::cacheDir = nullptr;
+QByteArray TDThumbnailProvider::cacheHome;
+
+void TDThumbnailProvider::SetUpTestCase()
+{
+    cacheDir = new QTemporaryDir;
+    cacheHome = qgetenv("XDG_CACHE_HOME");
+    qputenv("XDG_CACHE_HOME", QFile::encodeName(cacheDir->path()));
+}
+
+void TDThumbnailProvider::TearDownTestCase()
+{
+    if (cacheHome.isEmpty())
+        qunsetenv("XDG_CACHE_HOME");
+    else
+        qputenv("XDG_CACHE_HOME", cacheHome);
+
+    delete cacheDir;
+    cacheDir = nullptr;
+}
+
 void TDThumbnailProvider::SetUp()
 {
     provider = DThumbnailProvider::instance();
     provider_d = provider->d_func();
+
+    QReadLocker runningLocker(&provider_d->dataReadWriteLock);
+    running = provider_d->running;
+    runningLocker.unlock();
+
+    QReadLocker sizeLimitLocker(&provider_d->sizeLimitLock);
+    defaultSizeLimit = provider_d->defaultSizeLimit;
+    sizeLimitHash = provider_d->sizeLimitHash;
+    sizeLimitLocker.unlock();
+
+    ASSERT_TRUE(cacheDir->isValid());
+    ASSERT_TRUE(dir.isValid());
 }
 
 void TDThumbnailProvider::TearDown()
 {
+    QWriteLocker runningLocker(&provider_d->dataReadWriteLock);
+    provider_d->running = running;
+    runningLocker.unlock();
+
+    QWriteLocker sizeLimitLocker(&provider_d->sizeLimitLock);
+    provider_d->defaultSizeLimit = defaultSizeLimit;
+    provider_d->sizeLimitHash = sizeLimitHash;
+    sizeLimitLocker.unlock();
+
+    // 大小上限影响之前记录的失败文件
+    provider_d->clearKnownFailures();
+
     // gtest会释放静态部分数据 导致双重释放程序崩溃这里手动将数据清空防止崩溃事情发生
     provider_d->hasThumbnailMimeHash.clear();
 }
 
+QString TDThumbnailProvider::createImage(const QString &fileName, const QSize &size, const QColor &color) const
+{
+    const QString &filePath = dir.filePath(fileName);
+    QImage image(size, QImage::Format_RGB32);
+
+    image.fill(color);
+
+    return image.save(filePath) ? filePath : QString();
+}
+
+void TDThumbnailProvider::enqueue(DThumbnailProviderPrivate *d, const QString &file, int priority,
+                                  DThumbnailProvider::CallBack callback)
+{
+    DThumbnailProviderPrivate::ProduceInfo info;
+
+    info.fileInfo = QFileInfo(file);
+    info.size = DThumbnailProvider::Normal;
+    info.priority = priority;
+
+    DThumbnailProviderPrivate::ProduceRequest request;
+
+    request.callback = callback;
+    info.requests.append(request);
+
+    d->enqueue(std::move(info));
+}
+
+bool TDThumbnailProvider::waitForProduceQueue(int timeout) const
+{
+    QElapsedTimer timer;
+
+    timer.start();
+
+    while (!timer.hasExpired(timeout))
+    {
+        QReadLocker locker(&provider_d->dataReadWriteLock);
+
+        if (provider_d->produceQueue.isEmpty() && provider_d->activeWorkers == 0)
+            return true;
+
+        locker.unlock();
+        QThread::msleep(10);
+    }
+
+    return false;
+}
+
 #define TESTRES_PATH ":/images/logo_icon.svg"
 #define TESTRES_PATH_1 "no_exist"
 
@@ -119,6 +196,21 @@ TEST_F(TDThumbnailProvider, TestCreate)
     ASSERT_TRUE(provider->thumbnailFilePath(fi_notexisted, DThumbnailProvider::Normal).isEmpty());
 }
 
+TEST_F(TDThumbnailProvider, TestCreateThumbnails)
+{
+    if (qgetenv("QT_QPA_PLATFORM").contains("offscreen"))
+        return;
+
+    QFileInfo fi(TESTRES_PATH);
+    QSignalSpy finishedSpy(provider, SIGNAL(createThumbnailFinished(const QString &, const QString &)));
+    const QStringList &ret = provider->createThumbnails(fi, {DThumbnailProvider::Small, DThumbnailProvider::Large});
+    ASSERT_EQ(ret.size(), 2);
+    ASSERT_EQ(finishedSpy.count(), 2);
+    ASSERT_EQ(ret.at(0), provider->thumbnailFilePath(fi, DThumbnailProvider::Small));
+    ASSERT_EQ(ret.at(1), provider->thumbnailFilePath(fi, DThumbnailProvider::Large));
+    ASSERT_LE(QImage(ret.at(0)).width(), DThumbnailProvider::Small);
+}
+
 TEST_F(TDThumbnailProvider, testAttribute)
 {
     if (qgetenv("QT_QPA_PLATFORM").contains("offscreen"))
@@ -143,12 +235,718 @@ void testCallBack(const QString &)
 
 TEST_F(TDThumbnailProvider, TestProducrQueue)
 {
-    provider_d->running = true;
+    // 先停止所有工作线程，避免加入的任务在检查之前就被取走
+    QWriteLocker locker(&provider_d->dataReadWriteLock);
+    provider_d->running = false;
+    locker.unlock();
+    provider_d->waitCondition.wakeAll();
+    provider->wait();
+
+    for (QThread *worker : provider_d->workers)
+        worker->wait();
+
     provider->appendToProduceQueue(QFileInfo(TESTRES_PATH), DThumbnailProvider::Small);
     provider->appendToProduceQueue(QFileInfo(TESTRES_PATH), DThumbnailProvider::Large, &testCallBack);
+    provider->wait();
+
+    locker.relock();
     ASSERT_FALSE(provider_d->produceQueue.isEmpty());
+    locker.unlock();
 
     provider->removeInProduceQueue(QFileInfo(TESTRES_PATH), DThumbnailProvider::Small);
+
+    // 清空未处理的任务，之后的测试不受影响
+    locker.relock();
     ASSERT_FALSE(provider_d->discardedProduceInfos.isEmpty());
-    provider_d->running = false;
+    provider_d->produceQueue.clear();
+    provider_d->produceOrders.clear();
+    provider_d->discardedProduceInfos.clear();
+    provider_d->readaheadSources.clear();
+}
+
+TEST_F(TDThumbnailProvider, TestMaxThreadCount)
+{
+    const int count = provider->maxThreadCount();
+    ASSERT_GE(count, 1);
+
+    provider->setMaxThreadCount(2);
+    ASSERT_EQ(provider->maxThreadCount(), 2);
+
+    provider->setMaxThreadCount(0);
+    ASSERT_EQ(provider->maxThreadCount(), 1);
+
+    provider->setMaxThreadCount(count);
+}
+
+TEST_F(TDThumbnailProvider, TestProducePriority)
+{
+    DThumbnailProviderPrivate queue(nullptr);
+
+    enqueue(&queue, "/tmp/a", 0);
+    enqueue(&queue, "/tmp/b", 0);
+    enqueue(&queue, "/tmp/c", 1);
+    enqueue(&queue, "/tmp/d", -1);
+
+    ASSERT_EQ(queue.dequeue().fileInfo.absoluteFilePath(), QString("/tmp/c"));
+    ASSERT_EQ(queue.dequeue().fileInfo.absoluteFilePath(), QString("/tmp/b"));
+    ASSERT_EQ(queue.dequeue().fileInfo.absoluteFilePath(), QString("/tmp/a"));
+    ASSERT_EQ(queue.dequeue().fileInfo.absoluteFilePath(), QString("/tmp/d"));
+    ASSERT_TRUE(queue.produceQueue.isEmpty());
+    ASSERT_TRUE(queue.produceOrders.isEmpty());
+}
+
+TEST_F(TDThumbnailProvider, TestReadahead)
+{
+    DThumbnailProviderPrivate queue(nullptr);
+
+    queue.readaheadCount = 2;
+    enqueue(&queue, "/tmp/a", 0);
+    enqueue(&queue, "/tmp/b", 0);
+    enqueue(&queue, "/tmp/c", 0);
+    enqueue(&queue, "/tmp/d", 0);
+
+    ASSERT_EQ(queue.dequeue().fileInfo.absoluteFilePath(), QString("/tmp/d"));
+    ASSERT_EQ(queue.takeReadaheadFiles(), QStringList({"/tmp/c", "/tmp/b"}));
+    // 已预读的文件不会重复请求
+    ASSERT_TRUE(queue.takeReadaheadFiles().isEmpty());
+
+    ASSERT_EQ(queue.dequeue().fileInfo.absoluteFilePath(), QString("/tmp/c"));
+    ASSERT_EQ(queue.takeReadaheadFiles(), QStringList({"/tmp/a"}));
+    ASSERT_FALSE(queue.readaheadSources.contains("/tmp/c"));
+
+    queue.readaheadCount = 0;
+    queue.dequeue();
+    queue.dequeue();
+    ASSERT_TRUE(queue.takeReadaheadFiles().isEmpty());
+    ASSERT_TRUE(queue.readaheadSources.isEmpty());
+}
+
+TEST_F(TDThumbnailProvider, TestMergeProduceRequests)
+{
+    DThumbnailProviderPrivate queue(nullptr);
+    const DThumbnailProviderPrivate::ProduceKey key(QString("/tmp/a"), DThumbnailProvider::Normal);
+
+    enqueue(&queue, "/tmp/a", 0, &testCallBack);
+    enqueue(&queue, "/tmp/b", 0, &testCallBack);
+    enqueue(&queue, "/tmp/a", 1, &testCallBack);
+
+    ASSERT_EQ(queue.produceQueue.size(), 2);
+    ASSERT_EQ(queue.mergedProduceCount, 1);
+
+    const DThumbnailProviderPrivate::ProduceInfo &task = queue.dequeue();
+    ASSERT_EQ(task.fileInfo.absoluteFilePath(), QString("/tmp/a"));
+    ASSERT_EQ(task.requests.size(), 2);
+
+    // 正在生成的任务不与新的请求共享结果，新的请求在其结束后合并为一次重新生成
+    queue.inFlightTasks[key].requests = task.requests;
+    enqueue(&queue, "/tmp/a", 0, &testCallBack);
+    enqueue(&queue, "/tmp/a", 2);
+    ASSERT_EQ(queue.produceQueue.size(), 1);
+    ASSERT_EQ(queue.inFlightTasks.value(key).requests.size(), 2);
+    ASSERT_EQ(queue.inFlightTasks.value(key).pendingRequests.size(), 2);
+    ASSERT_EQ(queue.inFlightTasks.value(key).priority, 2);
+    ASSERT_EQ(queue.mergedProduceCount, 2);
+}
+
+TEST_F(TDThumbnailProvider, TestDiscardMergedRequest)
+{
+    DThumbnailProviderPrivate queue(nullptr);
+    const DThumbnailProviderPrivate::ProduceKey key(QString("/tmp/a"), DThumbnailProvider::Normal);
+
+    // 两个调用者合并为一个任务，其中一个移除后任务仍为另一个保留
+    enqueue(&queue, "/tmp/a", 0, &testCallBack);
+    enqueue(&queue, "/tmp/a", 0);
+    queue.discard(key);
+    ASSERT_FALSE(queue.discardedProduceInfos.contains(key));
+    ASSERT_EQ(queue.produceQueue.first().requests.size(), 1);
+    ASSERT_TRUE(bool(queue.produceQueue.first().requests.first().callback));
+
+    queue.discard(key);
+    ASSERT_TRUE(queue.discardedProduceInfos.contains(key));
+
+    // 正在生成的任务先移除等待重新生成的请求
+    queue.discardedProduceInfos.clear();
+    queue.dequeue();
+    queue.inFlightTasks[key].requests.append(DThumbnailProviderPrivate::ProduceRequest());
+    queue.inFlightTasks[key].pendingRequests.append(DThumbnailProviderPrivate::ProduceRequest());
+    queue.discard(key);
+    ASSERT_EQ(queue.inFlightTasks.value(key).requests.size(), 1);
+    ASSERT_TRUE(queue.inFlightTasks.value(key).pendingRequests.isEmpty());
+    queue.discard(key);
+    ASSERT_TRUE(queue.discardedProduceInfos.contains(key));
+
+    const QString &source = createImage("source.png", QSize(200, 100), Qt::magenta);
+    ASSERT_FALSE(source.isEmpty());
+
+    QSharedPointer<QAtomicInt> first(new QAtomicInt);
+    QSharedPointer<QAtomicInt> second(new QAtomicInt);
+
+    provider->appendToProduceQueue(QFileInfo(source), DThumbnailProvider::Normal, 0, [first](const QString &) {
+        first->ref();
+    });
+    provider->appendToProduceQueue(QFileInfo(source), DThumbnailProvider::Normal, 0, [second](const QString &) {
+        second->ref();
+    });
+    provider->removeInProduceQueue(QFileInfo(source), DThumbnailProvider::Normal);
+
+    for (int i = 0; i < 500 && first->loadAcquire() == 0; ++i)
+        QThread::msleep(10);
+
+    ASSERT_TRUE(waitForProduceQueue(5000));
+    ASSERT_EQ(first->loadAcquire(), 1);
+    ASSERT_EQ(second->loadAcquire(), 0);
+
+    // 全部请求被移除的任务结束后不留下标记
+    const QString &other = createImage("other.png", QSize(200, 100), Qt::cyan);
+    ASSERT_FALSE(other.isEmpty());
+
+    provider->appendToProduceQueue(QFileInfo(other), DThumbnailProvider::Normal, &testCallBack);
+    provider->removeInProduceQueue(QFileInfo(other), DThumbnailProvider::Normal);
+    ASSERT_TRUE(waitForProduceQueue(5000));
+
+    QReadLocker locker(&provider_d->dataReadWriteLock);
+    ASSERT_FALSE(provider_d->discardedProduceInfos.contains(qMakePair(QFileInfo(other).absoluteFilePath(), DThumbnailProvider::Normal)));
+}
+
+TEST_F(TDThumbnailProvider, TestRequeueWhileInFlight)
+{
+    const QString &source = createImage("source.png", QSize(400, 200), Qt::darkGreen);
+    ASSERT_FALSE(source.isEmpty());
+
+    // 已缓存的较小尺寸作为预览，预览在任务生成期间送达
+    ASSERT_FALSE(provider->createThumbnail(QFileInfo(source), DThumbnailProvider::Small).isEmpty());
+
+    struct State
+    {
+        QMutex mutex;
+        QString first;
+        QString second;
+        bool secondDone = false;
+    };
+
+    QSharedPointer<State> state(new State);
+    QSharedPointer<QAtomicInt> previews(new QAtomicInt);
+    DThumbnailProvider *provider = this->provider;
+
+    // 生成期间源文件被修改，如同 inotify 使缩略图失效后再次加入队列
+    auto preview = [state, previews, provider, source](const QImage &) {
+        if (previews->fetchAndAddOrdered(1) > 0)
+            return;
+
+        QFile file(source);
+
+        if (file.open(QIODevice::ReadWrite))
+        {
+            file.setFileTime(QDateTime::currentDateTime().addSecs(60), QFileDevice::FileModificationTime);
+            file.close();
+        }
+
+        provider->appendToProduceQueue(QFileInfo(source), DThumbnailProvider::Large, 0, [state](const QString &thumbnail) {
+            QMutexLocker locker(&state->mutex);
+            state->second = thumbnail;
+            state->secondDone = true;
+        });
+    };
+
+    provider->appendToProduceQueue(QFileInfo(source), DThumbnailProvider::Large, 0, preview, [state](const QString &thumbnail) {
+        QMutexLocker locker(&state->mutex);
+        state->first = thumbnail;
+    });
+
+    for (int i = 0; i < 500; ++i)
+    {
+        QMutexLocker locker(&state->mutex);
+
+        if (state->secondDone)
+            break;
+
+        locker.unlock();
+        QThread::msleep(10);
+    }
+
+    ASSERT_TRUE(waitForProduceQueue(5000));
+
+    QMutexLocker locker(&state->mutex);
+    ASSERT_GE(previews->loadAcquire(), 1);
+    ASSERT_FALSE(state->first.isEmpty());
+    ASSERT_FALSE(state->second.isEmpty());
+
+    // 重新生成的缩略图对应修改后的源文件
+    ASSERT_EQ(QImageReader(state->second).text(QT_STRINGIFY(Thumb::MTime)),
+              QString::number(QFileInfo(source).lastModified().toTime_t()));
+}
+
+TEST_F(TDThumbnailProvider, TestBatchDelivery)
+{
+    QObject target;
+    int callCount = 0;
+    QSignalSpy batchSpy(provider, SIGNAL(createThumbnailsBatchFinished(const QStringList &, const QStringList &)));
+    QSignalSpy finishedSpy(provider, SIGNAL(createThumbnailFinished(const QString &, const QString &)));
+
+    provider->setBatchDeliveryTarget(&target);
+    ASSERT_EQ(provider->batchDeliveryTarget(), &target);
+
+    for (int i = 0; i < 3; ++i)
+    {
+        DThumbnailProviderPrivate::ProduceResult result;
+        result.thumbnail = QString("/tmp/thumbnail_%1.png").arg(i);
+        result.notifications.append(qMakePair(QString("/tmp/%1").arg(i), result.thumbnail));
+        result.callbacks.append([&callCount](const QString &) { ++callCount; });
+        ASSERT_TRUE(provider_d->postResult(result));
+    }
+
+    // 结果在接收对象所在线程的下一次事件循环中一并处理
+    ASSERT_EQ(callCount, 0);
+    QCoreApplication::processEvents();
+    ASSERT_EQ(callCount, 3);
+    ASSERT_EQ(finishedSpy.count(), 3);
+    ASSERT_EQ(batchSpy.count(), 1);
+    ASSERT_EQ(batchSpy.first().first().toStringList().size(), 3);
+
+    provider->setBatchDeliveryTarget(nullptr);
+    ASSERT_FALSE(provider_d->postResult(DThumbnailProviderPrivate::ProduceResult()));
+}
+
+TEST_F(TDThumbnailProvider, TestGarbageCollection)
+{
+    provider->setCacheEntryLimit(DThumbnailProvider::Small, 100);
+    provider->setCacheSizeLimit(DThumbnailProvider::Small, -1);
+    ASSERT_EQ(provider->cacheEntryLimit(DThumbnailProvider::Small), 100);
+    ASSERT_EQ(provider->cacheSizeLimit(DThumbnailProvider::Small), 0);
+    ASSERT_EQ(provider->cacheEntryLimit(DThumbnailProvider::Large), 0);
+    provider->setCacheEntryLimit(DThumbnailProvider::Small, 0);
+
+    const QString &source = createImage("source.png", QSize(32, 32), Qt::blue);
+    ASSERT_FALSE(source.isEmpty());
+
+    const QString &thumbnail = provider->createThumbnail(QFileInfo(source), DThumbnailProvider::Small);
+    ASSERT_FALSE(thumbnail.isEmpty());
+
+    // 源文件删除后其缩略图会被清理
+    QFile::remove(source);
+    QSignalSpy spy(provider, SIGNAL(garbageCollectionFinished(qint64, int)));
+    provider_d->collectGarbage();
+    ASSERT_EQ(spy.count(), 1);
+    ASSERT_GE(spy.first().at(1).toInt(), 1);
+    ASSERT_FALSE(QFile::exists(thumbnail));
+
+    // 取消后仍发出结束信号
+    provider_d->garbageCollectionCanceled.storeRelease(1);
+    provider_d->collectGarbage();
+    provider_d->garbageCollectionCanceled.storeRelease(0);
+    ASSERT_EQ(spy.count(), 2);
+    ASSERT_EQ(spy.last().at(1).toInt(), 0);
+}
+
+TEST_F(TDThumbnailProvider, TestWatchDirectory)
+{
+    const QString &source = createImage("source.png", QSize(32, 32), Qt::green);
+    ASSERT_FALSE(source.isEmpty());
+
+    const QString &thumbnail = provider->createThumbnail(QFileInfo(source), DThumbnailProvider::Small);
+    ASSERT_FALSE(thumbnail.isEmpty());
+
+    ASSERT_TRUE(provider->watchDirectory(dir.path()));
+    ASSERT_TRUE(provider->watchedDirectories().contains(QFileInfo(dir.path()).absoluteFilePath()));
+
+    QSignalSpy spy(provider, SIGNAL(thumbnailChanged(const QString &, const QString &)));
+
+    // 修改时间变化后缩略图立即失效
+    QFile file(source);
+    ASSERT_TRUE(file.open(QIODevice::ReadWrite));
+    ASSERT_TRUE(file.setFileTime(QDateTime::currentDateTime().addSecs(60), QFileDevice::FileModificationTime));
+    file.close();
+
+    for (int i = 0; i < 100 && spy.isEmpty(); ++i)
+    {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 20);
+    }
+
+    ASSERT_FALSE(spy.isEmpty());
+    ASSERT_EQ(spy.first().at(0).toString(), QFileInfo(source).absoluteFilePath());
+    ASSERT_TRUE(spy.first().at(1).toString().isEmpty());
+
+    provider->unwatchDirectory(dir.path());
+    ASSERT_TRUE(provider->watchedDirectories().isEmpty());
+}
+
+TEST_F(TDThumbnailProvider, TestGenerateThumbnail)
+{
+    QList<QFileInfo> sources;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        const QString &source = createImage(QString("source_%1.png").arg(i), QSize(300 + i, 200), Qt::yellow);
+        ASSERT_FALSE(source.isEmpty());
+        sources.append(QFileInfo(source));
+    }
+
+    // 在多个线程中同时生成
+    QList<DThumbnailProvider::ThumbnailResult> results;
+    QList<QThread *> threads;
+
+    for (int i = 0; i < sources.size(); ++i)
+    {
+        results.append(DThumbnailProvider::ThumbnailResult());
+    }
+
+    for (int i = 0; i < sources.size(); ++i)
+    {
+        DThumbnailProvider::ThumbnailResult *result = &results[i];
+        const QFileInfo source = sources.at(i);
+
+        threads.append(QThread::create([this, result, source] {
+            *result = provider->generateThumbnail(source, DThumbnailProvider::Normal);
+        }));
+        threads.last()->start();
+    }
+
+    for (int i = 0; i < threads.size(); ++i)
+    {
+        threads.at(i)->wait();
+        delete threads.at(i);
+
+        ASSERT_FALSE(results.at(i).thumbnailPath.isEmpty());
+        ASSERT_TRUE(results.at(i).errorString.isEmpty());
+        ASSERT_GE(results.at(i).elapsed, 0);
+        ASSERT_EQ(results.at(i).sourceSize, QSize(300 + i, 200));
+    }
+
+    const DThumbnailProvider::ThumbnailResult &failed = provider->generateThumbnail(QFileInfo(TESTRES_PATH_1), DThumbnailProvider::Normal);
+    ASSERT_TRUE(failed.thumbnailPath.isEmpty());
+    ASSERT_FALSE(failed.errorString.isEmpty());
+}
+
+TEST_F(TDThumbnailProvider, TestMimeTypeCache)
+{
+    const QString &source = createImage("source.png", QSize(16, 16), Qt::white);
+    ASSERT_FALSE(source.isEmpty());
+
+    // 同一文件只检测一次
+    DThumbnailProviderPrivate d(nullptr);
+    d.mimeCache.setMaxCost(16);
+    ASSERT_EQ(d.mimeTypeForFile(QFileInfo(source)).name(), QString("image/png"));
+    ASSERT_EQ(d.mimeCache.size(), 1);
+    ASSERT_EQ(d.mimeTypeForFile(QFileInfo(source)).name(), QString("image/png"));
+    ASSERT_EQ(d.mimeCache.size(), 1);
+
+    provider->setExtensionOnlyMimeDirectories({dir.path()});
+    ASSERT_EQ(provider->extensionOnlyMimeDirectories().size(), 1);
+
+    const QString &fake = dir.filePath("fake.png");
+    QFile file(fake);
+    ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+    file.write("not a png");
+    file.close();
+    ASSERT_EQ(provider_d->mimeTypeForFile(QFileInfo(fake)).name(), QString("image/png"));
+
+    provider->setExtensionOnlyMimeDirectories({});
+}
+
+TEST_F(TDThumbnailProvider, TestImageBufferPool)
+{
+    DImageBufferPool pool;
+    QImage image(64, 48, QImage::Format_RGB32);
+    const uchar *bits = image.constBits();
+
+    ASSERT_TRUE(pool.acquire(QSize(64, 48), QImage::Format_RGB32).isNull());
+
+    // 仍被共享的图片不会放入池中
+    {
+        QImage shared = image;
+        pool.release(std::move(shared));
+        ASSERT_TRUE(pool.acquire(QSize(64, 48), QImage::Format_RGB32).isNull());
+    }
+
+    pool.release(std::move(image));
+    ASSERT_TRUE(pool.acquire(QSize(64, 48), QImage::Format_ARGB32).isNull());
+
+    const QImage &reused = pool.acquire(QSize(64, 48), QImage::Format_RGB32);
+    ASSERT_EQ(reused.constBits(), bits);
+    ASSERT_TRUE(pool.acquire(QSize(64, 48), QImage::Format_RGB32).isNull());
+}
+
+TEST_F(TDThumbnailProvider, TestDecodeMemoryLimit)
+{
+    const qint64 limit = provider->decodeMemoryLimit();
+    ASSERT_GT(limit, 0);
+
+    ASSERT_FALSE(createImage("large.png", QSize(1200, 1200), Qt::gray).isEmpty());
+    ASSERT_FALSE(createImage("large.bmp", QSize(1200, 1200), Qt::gray).isEmpty());
+
+    provider->setDecodeMemoryLimit(1024 * 1024);
+    ASSERT_EQ(provider->decodeMemoryLimit(), 1024 * 1024);
+
+    // PNG 可以按缩小后的大小解码，BMP 需要解码整张图片
+    const DThumbnailProvider::ThumbnailResult &png = provider->generateThumbnail(QFileInfo(dir.filePath("large.png")), DThumbnailProvider::Normal);
+    ASSERT_FALSE(png.thumbnailPath.isEmpty());
+
+    const DThumbnailProvider::ThumbnailResult &bmp = provider->generateThumbnail(QFileInfo(dir.filePath("large.bmp")), DThumbnailProvider::Normal);
+    ASSERT_TRUE(bmp.thumbnailPath.isEmpty());
+    ASSERT_FALSE(bmp.errorString.isEmpty());
+
+    // 超出上限不记录为失败，上限提高后可以生成
+    provider->setDecodeMemoryLimit(limit);
+    ASSERT_FALSE(provider->generateThumbnail(QFileInfo(dir.filePath("large.bmp")), DThumbnailProvider::Normal).thumbnailPath.isEmpty());
+}
+
+TEST_F(TDThumbnailProvider, TestThumbnailClaim)
+{
+    const QByteArray key("0123456789abcdef0123456789abcdef");
+    bool acquired = true;
+    bool contended = false;
+
+    {
+        DThumbnailClaim claim(key, 1000);
+        ASSERT_TRUE(claim.isAcquired());
+        ASSERT_FALSE(claim.isContended());
+
+        // 持有期间其它调用者无法获取，等待超时后放弃
+        QThread *thread = QThread::create([&] {
+            DThumbnailClaim other(key, 100);
+            acquired = other.isAcquired();
+            contended = other.isContended();
+        });
+        thread->start();
+        thread->wait();
+        delete thread;
+
+        ASSERT_FALSE(acquired);
+        ASSERT_TRUE(contended);
+
+        // 不等待时立即返回
+        DThumbnailClaim other(key, 0);
+        ASSERT_FALSE(other.isAcquired());
+        ASSERT_TRUE(other.isContended());
+    }
+
+    DThumbnailClaim claim(key, 1000);
+    ASSERT_TRUE(claim.isAcquired());
+    ASSERT_FALSE(claim.isContended());
+}
+
+TEST_F(TDThumbnailProvider, TestThumbnailIndexHint)
+{
+    const QString &source = createImage("source.png", QSize(64, 64), Qt::cyan);
+    ASSERT_FALSE(source.isEmpty());
+
+    const QFileInfo info(source);
+    const qint64 mtime = info.lastModified().toTime_t();
+    const bool enabled = provider->thumbnailIndexEnabled();
+
+    provider->setThumbnailIndexEnabled(true);
+
+    const QString &thumbnail = provider->createThumbnail(info, DThumbnailProvider::Small);
+    ASSERT_FALSE(thumbnail.isEmpty());
+
+    DThumbnailIndex *index = provider_d->thumbnailIndex(provider_d->sizeToFilePath(DThumbnailProvider::Small));
+    ASSERT_TRUE(index);
+
+    const QByteArray &hash = QByteArray::fromHex(QFileInfo(thumbnail).completeBaseName().toLatin1());
+
+    // 索引中的记录已过期而缩略图本身有效时（如由不使用索引的进程生成），保留缩略图并更新索引
+    index->insert(hash, DThumbnailIndex::Valid, mtime - 1, info.size());
+    ASSERT_EQ(provider->thumbnailFilePath(info, DThumbnailProvider::Small), thumbnail);
+    ASSERT_EQ(index->find(hash).mtime, mtime);
+
+    // 缩略图文件已不存在时不使用索引中的记录
+    ASSERT_TRUE(QFile::remove(thumbnail));
+    ASSERT_TRUE(provider->thumbnailFilePath(info, DThumbnailProvider::Small).isEmpty());
+    ASSERT_NE(index->find(hash).state, DThumbnailIndex::Valid);
+
+    // 失败标记已被删除时不使用索引中的失败记录
+    const QString &other = createImage("other.png", QSize(64, 64), Qt::cyan);
+    ASSERT_FALSE(other.isEmpty());
+
+    const QFileInfo otherInfo(other);
+    const QString &url = QUrl::fromLocalFile(otherInfo.absoluteFilePath()).toString(QUrl::FullyEncoded);
+    const QByteArray &urlHash = QCryptographicHash::hash(url.toLocal8Bit(), QCryptographicHash::Md5);
+    DThumbnailIndex *failIndex = provider_d->thumbnailIndex(QFileInfo(provider_d->sizeToFilePath(DThumbnailProvider::Small)).path() + "/fail");
+    ASSERT_TRUE(failIndex);
+
+    failIndex->insert(urlHash, DThumbnailIndex::Failed, otherInfo.lastModified().toTime_t(), otherInfo.size());
+    ASSERT_FALSE(provider->createThumbnail(otherInfo, DThumbnailProvider::Small).isEmpty());
+    ASSERT_NE(failIndex->find(urlHash).state, DThumbnailIndex::Failed);
+
+    provider->setThumbnailIndexEnabled(enabled);
+}
+
+TEST_F(TDThumbnailProvider, TestHiDpiSize)
+{
+    ASSERT_TRUE(provider_d->sizeToFilePath(DThumbnailProvider::XLarge).endsWith("/x-large"));
+    ASSERT_TRUE(provider_d->sizeToFilePath(DThumbnailProvider::XXLarge).endsWith("/xx-large"));
+    ASSERT_TRUE(provider_d->isThumbnailDirectory(provider_d->sizeToFilePath(DThumbnailProvider::XXLarge)));
+
+    ASSERT_EQ(DThumbnailProvider::sizeForPixelSize(100), DThumbnailProvider::Normal);
+    ASSERT_EQ(DThumbnailProvider::sizeForPixelSize(256, 2), DThumbnailProvider::XLarge);
+    ASSERT_EQ(DThumbnailProvider::sizeForPixelSize(300, 1.5), DThumbnailProvider::XLarge);
+    ASSERT_EQ(DThumbnailProvider::sizeForPixelSize(800, 2), DThumbnailProvider::XXLarge);
+
+    const QString &source = createImage("source.png", QSize(1200, 600), Qt::red);
+    ASSERT_FALSE(source.isEmpty());
+
+    const QImage &thumbnail = provider->thumbnailImage(QFileInfo(source), 128, 2);
+    ASSERT_EQ(thumbnail.size(), QSize(256, 128));
+    ASSERT_EQ(thumbnail.devicePixelRatio(), 2);
+    ASSERT_FALSE(provider->thumbnailFilePath(QFileInfo(source), DThumbnailProvider::Large).isEmpty());
+
+    // 已有更大的缩略图时直接缩小使用，不再生成所需的尺寸
+    ASSERT_FALSE(provider->createThumbnail(QFileInfo(source), DThumbnailProvider::XXLarge).isEmpty());
+    ASSERT_EQ(provider->thumbnailImage(QFileInfo(source), 300, 1.5).size(), QSize(450, 225));
+    ASSERT_TRUE(provider->thumbnailFilePath(QFileInfo(source), DThumbnailProvider::XLarge).isEmpty());
+}
+
+TEST_F(TDThumbnailProvider, TestNegativeCache)
+{
+    const QString &source = dir.filePath("broken.png");
+    QFile file(source);
+    ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+    file.write("\x89PNG\r\n\x1a\n broken");
+    file.close();
+
+    const QFileInfo info(source);
+    const qint64 mtime = info.lastModified().toTime_t();
+    QString errorString;
+
+    ASSERT_TRUE(provider->createThumbnail(info, DThumbnailProvider::Small).isEmpty());
+    ASSERT_TRUE(provider_d->isKnownFailure(info, mtime, &errorString));
+
+    // 记录命中时不再读取失败记录文件
+    provider_d->addKnownFailure(info, mtime, "known failure");
+    ASSERT_TRUE(provider->createThumbnail(info, DThumbnailProvider::Small).isEmpty());
+    ASSERT_EQ(provider->errorString(), QString("known failure"));
+
+    // 修改时间或大小改变后记录失效
+    ASSERT_FALSE(provider_d->isKnownFailure(info, mtime + 1, &errorString));
+
+    provider->setNegativeCacheTimeout(0);
+    ASSERT_FALSE(provider_d->isKnownFailure(info, mtime, &errorString));
+    provider->createThumbnail(info, DThumbnailProvider::Small);
+    ASSERT_FALSE(provider_d->isKnownFailure(info, mtime, &errorString));
+    provider->setNegativeCacheTimeout(5 * 60 * 1000);
+}
+
+TEST_F(TDThumbnailProvider, TestPreview)
+{
+    const QString &source = createImage("source.png", QSize(800, 400), Qt::blue);
+    ASSERT_FALSE(source.isEmpty());
+
+    const QFileInfo info(source);
+
+    // 没有可用的预览来源
+    ASSERT_TRUE(provider_d->createPreview(info, DThumbnailProvider::Large).isNull());
+
+    // 已缓存的较小尺寸可以作为预览
+    ASSERT_FALSE(provider->createThumbnail(info, DThumbnailProvider::Small).isEmpty());
+    const QImage &preview = provider_d->createPreview(info, DThumbnailProvider::Large);
+    ASSERT_EQ(preview.size(), QSize(64, 32));
+
+    // 缩略图已存在时不需要预览
+    ASSERT_FALSE(provider->createThumbnail(info, DThumbnailProvider::Large).isEmpty());
+    ASSERT_TRUE(provider_d->createPreview(info, DThumbnailProvider::Large).isNull());
+
+    // 更大的尺寸缩小后作为预览
+    ASSERT_EQ(provider_d->createPreview(info, DThumbnailProvider::Normal).size(), QSize(128, 64));
+
+    ASSERT_FALSE(provider->progressiveThumbnailEnabled());
+    provider->setProgressiveThumbnailEnabled(true);
+    ASSERT_TRUE(provider->progressiveThumbnailEnabled());
+    provider->setProgressiveThumbnailEnabled(false);
+}
+
+TEST_F(TDThumbnailProvider, TestStatistics)
+{
+    DThumbnailStatistics statistics;
+
+    statistics.recordDecode("image/png", 0);
+    statistics.recordDecode("image/png", 3000);
+    statistics.recordDecode("image/jpeg", 1000000);
+    statistics.recordWrite(1500);
+    statistics.add(DThumbnailStatistics::BytesWritten, 100);
+
+    const QVariantMap &map = statistics.toVariantMap();
+    const QVariantMap &png = map.value("decodeLatency").toMap().value("image/png").toMap();
+    const QVariantList &buckets = png.value("buckets").toList();
+
+    // 0 微秒在第0个区间，3 微秒在第2个区间
+    ASSERT_EQ(png.value("count").toULongLong(), 2u);
+    ASSERT_EQ(buckets.size(), 3);
+    ASSERT_EQ(buckets.at(0).toULongLong(), 1u);
+    ASSERT_EQ(buckets.at(2).toULongLong(), 1u);
+    ASSERT_TRUE(map.value("decodeLatency").toMap().contains("image/jpeg"));
+    ASSERT_EQ(map.value("writeLatency").toMap().value("count").toULongLong(), 1u);
+    ASSERT_EQ(map.value("bytesWritten").toLongLong(), 100);
+
+    statistics.reset();
+    ASSERT_EQ(statistics.toVariantMap().value("bytesWritten").toLongLong(), 0);
+
+    const QString &source = createImage("source.png", QSize(300, 200), Qt::green);
+    ASSERT_FALSE(source.isEmpty());
+
+    const QFileInfo info(source);
+
+    provider->resetStatistics();
+    ASSERT_TRUE(provider->thumbnailFilePath(info, DThumbnailProvider::Normal).isEmpty());
+    ASSERT_FALSE(provider->createThumbnail(info, DThumbnailProvider::Normal).isEmpty());
+
+    const QVariantMap &providerMap = provider->statistics();
+
+    ASSERT_GE(providerMap.value("cacheMisses").toLongLong(), 1);
+    ASSERT_EQ(providerMap.value("thumbnailsCreated").toLongLong(), 1);
+    ASSERT_GT(providerMap.value("bytesWritten").toLongLong(), 0);
+    ASSERT_TRUE(providerMap.value("decodeLatency").toMap().contains("image/png"));
+    ASSERT_TRUE(providerMap.contains("queueDepth"));
+    ASSERT_TRUE(providerMap.contains("inFlight"));
+
+    ASSERT_EQ(provider->statisticsInterval(), 0);
+    provider->setStatisticsInterval(10);
+    ASSERT_EQ(provider->statisticsInterval(), 10);
+
+    QSignalSpy spy(provider, SIGNAL(statisticsUpdated(const QVariantMap &)));
+    ASSERT_TRUE(spy.wait(1000));
+
+    provider->setStatisticsInterval(0);
+    ASSERT_EQ(provider->statisticsInterval(), 0);
+}
+
+TEST_F(TDThumbnailProvider, TestDeviceSource)
+{
+    QImage image(400, 200, QImage::Format_RGB32);
+    image.fill(Qt::yellow);
+
+    QByteArray data;
+    QBuffer buffer(&data);
+    ASSERT_TRUE(buffer.open(QIODevice::WriteOnly));
+    ASSERT_TRUE(image.save(&buffer, "PNG"));
+    buffer.close();
+
+    const QString cacheKey = QStringLiteral("archive:///tmp/ut_dthumbnailprovider.zip#%1.png").arg(QDateTime::currentMSecsSinceEpoch());
+    const qint64 mtime = QDateTime::currentDateTime().toTime_t();
+
+    ASSERT_TRUE(provider->thumbnailFilePath(cacheKey, mtime, DThumbnailProvider::Normal).isEmpty());
+
+    QSignalSpy finishedSpy(provider, SIGNAL(createThumbnailFinished(const QString &, const QString &)));
+    const QString &thumbnail = provider->createThumbnail(data, cacheKey, mtime, DThumbnailProvider::Normal);
+    ASSERT_FALSE(thumbnail.isEmpty());
+    ASSERT_EQ(finishedSpy.count(), 1);
+    ASSERT_EQ(finishedSpy.first().first().toString(), cacheKey);
+    ASSERT_EQ(QImage(thumbnail).size(), QSize(128, 64));
+    ASSERT_EQ(QImageReader(thumbnail).text(QT_STRINGIFY(Thumb::URL)), cacheKey);
+
+    // 与文件的缩略图使用相同的目录结构
+    ASSERT_EQ(QFileInfo(thumbnail).absolutePath(), provider_d->sizeToFilePath(DThumbnailProvider::Normal));
+    ASSERT_EQ(provider->thumbnailFilePath(cacheKey, mtime, DThumbnailProvider::Normal), thumbnail);
+    ASSERT_TRUE(provider->thumbnailFilePath(cacheKey, mtime + 1, DThumbnailProvider::Normal).isEmpty());
+
+    // 未打开的设备以只读方式打开
+    QBuffer device(&data);
+    ASSERT_FALSE(provider->createThumbnail(&device, cacheKey + ".small", mtime, DThumbnailProvider::Small).isEmpty());
+
+    const QString &brokenKey = cacheKey + ".broken";
+    ASSERT_TRUE(provider->createThumbnail(QByteArray("not an image"), brokenKey, mtime, DThumbnailProvider::Normal).isEmpty());
+    ASSERT_FALSE(provider->errorString().isEmpty());
+    ASSERT_TRUE(provider->createThumbnail(data, brokenKey, mtime, DThumbnailProvider::Normal).isEmpty());
+    ASSERT_FALSE(provider->createThumbnail(data, brokenKey, mtime + 1, DThumbnailProvider::Normal).isEmpty());
+
+    ASSERT_TRUE(provider->createThumbnail(static_cast<QIODevice *>(nullptr), cacheKey, mtime, DThumbnailProvider::Normal).isEmpty());
 }
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2021 ~ 2021 Deepin Technology Co., Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+#include "private/dthumbnailservice_p.h"
+
+#include <QAtomicInt>
+#include <QTemporaryDir>
+
+#include <unistd.h>
+
+DGUI_USE_NAMESPACE
+
+TEST(TDThumbnailService, TestRequest)
+{
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+
+    const QString &source = dir.filePath("source.png");
+    QImage image(64, 32, QImage::Format_RGB32);
+    image.fill(Qt::green);
+    ASSERT_TRUE(image.save(source));
+
+    QAtomicInt loadCount;
+    auto loader = [&loadCount] (const QString &filePath, int size, QString *errorString) {
+        loadCount.ref();
+
+        const QImage image(filePath);
+
+        if (image.isNull())
+        {
+            *errorString = "Can not read " + filePath;
+        }
+
+        return image.scaled(size, size, Qt::KeepAspectRatio);
+    };
+
+    DThumbnailService server(loader);
+    DThumbnailService client(loader);
+
+    ASSERT_TRUE(server.start());
+    ASSERT_TRUE(server.isServer());
+    ASSERT_TRUE(client.start());
+    ASSERT_FALSE(client.isServer());
+
+    QString errorString;
+    const QImage &thumbnail = client.request(source, 16, &errorString);
+
+    ASSERT_TRUE(errorString.isEmpty());
+    ASSERT_EQ(thumbnail.size(), QSize(16, 8));
+    ASSERT_EQ(thumbnail.pixel(0, 0), QColor(Qt::green).rgb());
+
+    // 相同的请求使用服务中缓存的图片
+    ASSERT_FALSE(server.request(source, 16, &errorString).isNull());
+    ASSERT_EQ(loadCount.load(), 1);
+
+    ASSERT_TRUE(client.request(dir.filePath("missing.png"), 16, &errorString).isNull());
+    ASSERT_FALSE(errorString.isEmpty());
+
+    // 提供服务的进程退出后由客户端接替
+    server.stop();
+    errorString.clear();
+    ASSERT_FALSE(client.request(source, 16, &errorString).isNull());
+    ASSERT_TRUE(client.isServer());
+
+    client.stop();
+    ASSERT_FALSE(client.isRunning());
+}
+
+TEST(TDThumbnailService, TestIdleConnections)
+{
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+
+    const QString &source = dir.filePath("source.png");
+    QImage image(64, 32, QImage::Format_RGB32);
+    image.fill(Qt::green);
+    ASSERT_TRUE(image.save(source));
+
+    auto loader = [] (const QString &filePath, int size, QString *) {
+        return QImage(filePath).scaled(size, size, Qt::KeepAspectRatio);
+    };
+
+    DThumbnailService server(loader);
+    DThumbnailService client(loader);
+
+    ASSERT_TRUE(server.start());
+
+    const int threadCount = server.clientThreads.size();
+    QList<int> connections;
+
+    // 空闲的连接占满所有处理线程，不会为客户端创建新线程，空闲的连接超时关闭后客户端的请求仍会得到处理
+    for (int i = 0; i < threadCount; ++i)
+    {
+        const int fd = DThumbnailService::connectToServer();
+
+        ASSERT_GE(fd, 0);
+        connections.append(fd);
+    }
+
+    ASSERT_TRUE(client.start());
+
+    QString errorString;
+    bool unavailable = false;
+
+    ASSERT_FALSE(client.request(source, 16, &errorString, &unavailable).isNull());
+    ASSERT_FALSE(unavailable);
+    ASSERT_EQ(server.clientThreads.size(), threadCount);
+
+    for (int fd : connections)
+    {
+        close(fd);
+    }
+
+    client.stop();
+    server.stop();
+}
@@ -60,7 +60,11 @@ SOURCES += \
     src/ut_dfontmanager.cpp \
     src/ut_dsvgrenderer.cpp \
     src/ut_dtaskbarcontrol.cpp \
-    src/ut_dthumbnailprovider.cpp
+    src/ut_dexternalthumbnailer.cpp \
+    src/ut_dimagescaler.cpp \
+    src/ut_dthumbnailindex.cpp \
+    src/ut_dthumbnailprovider.cpp \
+    src/ut_dthumbnailservice.cpp
 
 RESOURCES += \
     res.qrc